@@ -0,0 +1,1106 @@
+// Object Oriented Programming - Secret Message Encoder & Decoder
+// Designed and Developed by Kobi Chambers - Griffith University
+//
+// Diamond grid codec library: header-only, with no console interaction, so it
+// can be embedded in other programs.
+
+#ifndef DIAMOND_CODEC_H
+#define DIAMOND_CODEC_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+constexpr int global_max_size{static_cast<int>(std::sqrt(1000))};
+constexpr int stream_default_size{127};
+constexpr int stream_max_size{4095};
+// Grids at least this large are traversed tile by tile, path_tile_size cells
+// a side, once a grid no longer fits in the L2 cache.
+constexpr int blocked_min_size{511};
+constexpr int path_tile_size{64};
+constexpr int square(int x) { return x * x; }
+constexpr int decoded_length(int x) { return (square(x) + 1) / 2; }
+class CustomException : public std::exception {
+ private:
+  std::string exception_message_;
+
+ public:
+  CustomException(const char *msg) : exception_message_{msg} {}
+
+  const char *what() const noexcept override {
+    return exception_message_.c_str();
+  }
+};
+
+class GridBoundary {
+ private:
+  int top_, bottom_, right_;
+
+ public:
+  GridBoundary(int top, int bottom, int right)
+      : top_{top}, bottom_{bottom}, right_{right} {}
+
+  void manipulate_boundary() {
+    ++top_;
+    --bottom_;
+    --right_;
+  }
+
+  bool within_row_bounds(int row) const {
+    return (row > top_ && row < bottom_);
+  }
+
+  bool within_col_bounds(int col) const { return col < right_; }
+
+  bool is_within_boundary(int row, int col) const {
+    return (within_row_bounds(row) && within_col_bounds(col));
+  }
+};
+
+constexpr std::int64_t integer_sqrt(std::int64_t x) {
+  if (x < 2) {
+    return x;
+  }
+  int bits{0};
+  while ((x >> bits) > 0) {
+    bits += 2;
+  }
+  std::int64_t root{std::int64_t{1} << (bits / 2)};
+  std::int64_t next{(root + x / root) / 2};
+  while (next < root) {
+    root = next;
+    next = (root + x / root) / 2;
+  }
+  return root;
+}
+
+// Row-major cell holding character `index` of a message in a grid. Ring j
+// (counted from the outside) is the diamond of radius d = centre - j around
+// the centre cell; it starts at its leftmost point and holds 4d characters,
+// so the ring is found by solving offset(j) = 4jc - 2j(j - 1) for j.
+constexpr int diamond_cell(int grid_size, int index) {
+  const std::int64_t centre{grid_size / 2};
+  const std::int64_t b{4 * centre + 2};
+  std::int64_t ring{(b - integer_sqrt(b * b - 8 * std::int64_t{index})) / 4};
+  auto ring_offset{[centre](std::int64_t j) {
+    return 4 * j * centre - 2 * j * (j - 1);
+  }};
+  while (ring > 0 && ring_offset(ring) > index) {
+    --ring;
+  }
+  while (ring < centre && ring_offset(ring + 1) <= index) {
+    ++ring;
+  }
+
+  const std::int64_t radius{centre - ring};
+  if (radius == 0) {
+    return static_cast<int>(centre * grid_size + centre);
+  }
+  const std::int64_t step{index - ring_offset(ring)};
+  const std::int64_t side{step / radius};
+  const std::int64_t along{step % radius};
+  std::int64_t row{0};
+  std::int64_t col{0};
+  switch (side) {
+    case 0: {
+      row = centre - along;
+      col = ring + along;
+      break;
+    }
+    case 1: {
+      row = ring + along;
+      col = centre + along;
+      break;
+    }
+    case 2: {
+      row = centre + along;
+      col = centre + radius - along;
+      break;
+    }
+    default: {
+      row = centre + radius - along;
+      col = centre - along;
+    }
+  }
+  return static_cast<int>(row * grid_size + col);
+}
+
+// One diagonal run of a diamond path within a single tile: length message
+// characters from message_index on, stored stride cells apart from cell.
+struct PathSegment {
+  std::uint32_t message_index;
+  std::uint32_t cell;
+  std::int32_t stride;
+  std::uint32_t length;
+};
+
+// Diamond traversal order depends only on the grid size, so each path is
+// walked once and shared by every encode / decode of that size.
+class PermutationCache {
+ private:
+  inline static std::mutex cache_mutex_;
+  inline static std::unordered_map<int, std::shared_ptr<const std::vector<int>>>
+      cache_;
+  inline static std::unordered_map<
+      int, std::shared_ptr<const std::vector<PathSegment>>>
+      blocked_cache_;
+
+ public:
+  // Walks the nested diamonds from the middle left, recording the row-major
+  // index of each visited cell in message order.
+  static std::vector<int> build_path(int grid_size) {
+    const int swap{-1};
+    const int max_decoded_length{decoded_length(grid_size)};
+
+    std::vector<int> path;
+    path.reserve(max_decoded_length);
+    std::vector<bool> visited(square(grid_size), false);
+    GridBoundary boundary{0, grid_size - 1, grid_size - 1};
+    int row{grid_size / 2};
+    int col{0};
+    int row_manip{-1};
+    int col_manip{1};
+    while (true) {
+      path.push_back(row * grid_size + col);
+      visited[row * grid_size + col] = true;
+      if (static_cast<int>(path.size()) == max_decoded_length) {
+        break;
+      }
+      if (!boundary.within_row_bounds(row)) {
+        row_manip *= swap;
+      }
+      if (!boundary.within_col_bounds(col)) {
+        col_manip *= swap;
+      }
+
+      row += row_manip;
+      col += col_manip;
+      if (boundary.is_within_boundary(row, col) &&
+          visited[row * grid_size + col]) {
+        ++col;
+        col_manip *= swap;
+        boundary.manipulate_boundary();
+      }
+    }
+    return path;
+  }
+
+  static std::shared_ptr<const std::vector<int>> get_path(int grid_size) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto &path{cache_[grid_size]};
+    if (!path) {
+      path = std::make_shared<const std::vector<int>>(build_path(grid_size));
+    }
+    return path;
+  }
+
+  // The same path cut into segments at every tile boundary and ordered tile
+  // by tile in row-major order. Following the segments touches one tile of
+  // the grid at a time, so a large grid streams through the cache instead of
+  // missing on nearly every diagonal step. Segments come straight from the
+  // ring geometry, so no full path or visited grid is ever built.
+  static std::vector<PathSegment> build_blocked_path(int grid_size) {
+    const int centre{grid_size / 2};
+    const int tiles_per_side{(grid_size + path_tile_size - 1) / path_tile_size};
+    std::vector<std::pair<int, PathSegment>> tiled_segments;
+    std::uint32_t message_index{0};
+    auto add_run{[&](int row, int col, int row_step, int col_step,
+                     int length) {
+      while (length > 0) {
+        // Steps left before the row or column leaves the current tile.
+        const int row_room{row_step > 0 ? path_tile_size - row % path_tile_size
+                                        : row % path_tile_size + 1};
+        const int col_room{col_step > 0 ? path_tile_size - col % path_tile_size
+                                        : col % path_tile_size + 1};
+        const int run_length{std::min({length, row_room, col_room})};
+        const int tile{(row / path_tile_size) * tiles_per_side +
+                       col / path_tile_size};
+        tiled_segments.push_back(
+            {tile,
+             {message_index, static_cast<std::uint32_t>(row * grid_size + col),
+              row_step * grid_size + col_step,
+              static_cast<std::uint32_t>(run_length)}});
+        message_index += run_length;
+        row += row_step * run_length;
+        col += col_step * run_length;
+        length -= run_length;
+      }
+    }};
+
+    for (int ring{0}; ring < centre; ring++) {
+      const int radius{centre - ring};
+      add_run(centre, ring, -1, 1, radius);
+      add_run(ring, centre, 1, 1, radius);
+      add_run(centre, centre + radius, 1, -1, radius);
+      add_run(centre + radius, centre, -1, -1, radius);
+    }
+    add_run(centre, centre, 1, 1, 1);
+
+    std::stable_sort(tiled_segments.begin(), tiled_segments.end(),
+                     [](const auto &left, const auto &right) {
+                       return left.first < right.first;
+                     });
+    std::vector<PathSegment> segments;
+    segments.reserve(tiled_segments.size());
+    for (const auto &tiled_segment : tiled_segments) {
+      segments.push_back(tiled_segment.second);
+    }
+    return segments;
+  }
+
+  static std::shared_ptr<const std::vector<PathSegment>> get_blocked_path(
+      int grid_size) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto &segments{blocked_cache_[grid_size]};
+    if (!segments) {
+      segments = std::make_shared<const std::vector<PathSegment>>(
+          build_blocked_path(grid_size));
+    }
+    return segments;
+  }
+};
+
+constexpr std::uint64_t mix_bits(std::uint64_t value) {
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+  return value ^ (value >> 31);
+}
+
+// Hashes a message eight bytes at a time.
+inline std::uint64_t hash_message(std::string_view message, std::uint64_t seed = 0) {
+  std::uint64_t hash{seed ^ (message.length() * 0x9E3779B97F4A7C15ull)};
+  std::size_t index{0};
+  for (; index + 8 <= message.length(); index += 8) {
+    std::uint64_t word;
+    std::memcpy(&word, message.data() + index, sizeof(word));
+    hash = mix_bits(hash ^ word);
+  }
+  std::uint64_t tail{0};
+  std::memcpy(&tail, message.data() + index, message.length() - index);
+  return mix_bits(hash ^ tail ^ 0xFF);
+}
+
+// xoshiro256** seeded through splitmix64.
+class Xoshiro256 {
+ private:
+  std::uint64_t state_[4];
+
+  static constexpr std::uint64_t rotate_left(std::uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+  }
+
+ public:
+  Xoshiro256(std::uint64_t seed) {
+    for (auto &word : state_) {
+      seed += 0x9E3779B97F4A7C15ull;
+      word = mix_bits(seed);
+    }
+  }
+
+  std::uint64_t next() {
+    const std::uint64_t result{rotate_left(state_[1] * 5, 7) * 9};
+    const std::uint64_t shifted{state_[1] << 17};
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= shifted;
+    state_[3] = rotate_left(state_[3], 45);
+    return result;
+  }
+
+  // Four letters per draw, each scaled from 16 random bits into 'A'-'Z'.
+  void fill_letters(char *letters, std::size_t count) {
+    std::size_t index{0};
+    while (index < count) {
+      std::uint64_t bits{next()};
+      for (int lane{0}; lane < 4 && index < count; lane++, bits >>= 16) {
+        letters[index++] = static_cast<char>('A' + (((bits & 0xFFFF) * 26) >> 16));
+      }
+    }
+  }
+};
+
+// Supplies the random letters written into grid cells the message leaves
+// empty.
+class PaddingSource {
+ public:
+  virtual ~PaddingSource() = default;
+
+  // message_key identifies the message being encoded, for sources that must
+  // reproduce the same padding for the same message.
+  virtual void fill(char *padding, std::size_t count,
+                    std::uint64_t message_key) = 0;
+
+  virtual bool is_deterministic() const { return false; }
+};
+
+// Each thread seeds its own generator once, so padding a message costs no
+// system calls or locking.
+class FastPadding : public PaddingSource {
+ public:
+  void fill(char *padding, std::size_t count, std::uint64_t) override {
+    thread_local Xoshiro256 generator{
+        (static_cast<std::uint64_t>(std::random_device{}()) << 32) ^
+        std::hash<std::thread::id>{}(std::this_thread::get_id()) ^
+        static_cast<std::uint64_t>(
+            std::chrono::steady_clock::now().time_since_epoch().count())};
+    generator.fill_letters(padding, count);
+  }
+};
+
+// Derives padding from the seed and the message alone, so encoded output is
+// reproducible regardless of thread or call order.
+class SeededPadding : public PaddingSource {
+ private:
+  std::uint64_t seed_;
+
+ public:
+  SeededPadding(std::uint64_t seed) : seed_{seed} {}
+
+  void fill(char *padding, std::size_t count,
+            std::uint64_t message_key) override {
+    Xoshiro256 generator{seed_ ^ mix_bits(message_key)};
+    generator.fill_letters(padding, count);
+  }
+
+  bool is_deterministic() const override { return true; }
+};
+
+// Encoded grids made only of 'A'-'Z' can be held at five bits a cell: cell i
+// occupies bits 5i to 5i + 4 of a little-endian bit stream and holds the
+// letter's offset from 'A', so eight cells take five bytes.
+constexpr std::size_t packed_size(std::size_t cell_count) {
+  return (cell_count * 5 + 7) / 8;
+}
+
+inline char packed_letter(const char *packed, std::size_t cell) {
+  const std::size_t bit{cell * 5};
+  unsigned bits{static_cast<unsigned char>(packed[bit / 8])};
+  if (bit % 8 > 3) {
+    bits |= static_cast<unsigned>(static_cast<unsigned char>(packed[bit / 8 + 1]))
+            << 8;
+  }
+  return static_cast<char>('A' + ((bits >> (bit % 8)) & 0x1F));
+}
+
+// Message order of an N x N grid, evaluated at compile time.
+template <int N>
+constexpr std::array<std::int16_t, decoded_length(N)> make_diamond_table() {
+  std::array<std::int16_t, decoded_length(N)> table{};
+  for (int index{0}; index < decoded_length(N); index++) {
+    table[index] = static_cast<std::int16_t>(diamond_cell(N, index));
+  }
+  return table;
+}
+
+// Kernels specialised for one grid size. The path is a constexpr table and
+// the scatter / gather expand into straight-line code, one move per cell.
+template <int N>
+class Codec {
+ private:
+  static_assert(N >= 3 && N % 2 == 1, "Grid size must be an odd number >= 3.");
+
+  static constexpr std::array<std::int16_t, decoded_length(N)> path_{
+      make_diamond_table<N>()};
+
+  template <std::size_t... Index>
+  static void scatter(std::string_view message, char *output,
+                      std::index_sequence<Index...>) {
+    ((Index < message.length() && message[Index] != ' '
+          ? void(output[path_[Index]] = message[Index])
+          : void()),
+     ...);
+  }
+
+  template <std::size_t... Index>
+  static void gather(const char *encoded_message, char *output,
+                     std::index_sequence<Index...>) {
+    ((output[Index] = encoded_message[path_[Index]]), ...);
+  }
+
+  template <std::size_t... Index>
+  static void gather_packed(const char *packed, char *output,
+                            std::index_sequence<Index...>) {
+    ((output[Index] = packed_letter(packed, path_[Index])), ...);
+  }
+
+ public:
+  static constexpr int grid_size{N};
+  static constexpr int length{decoded_length(N)};
+
+  static constexpr int cell(int index) { return path_[index]; }
+
+  // Overlays the message onto an already padded grid; spaces stay padding.
+  static void encode(std::string_view message, char *output) {
+    scatter(message, output, std::make_index_sequence<length>{});
+  }
+
+  static void decode(const char *encoded_message, char *output) {
+    gather(encoded_message, output, std::make_index_sequence<length>{});
+  }
+
+  // Reads each message cell straight out of the packed grid; every bit
+  // offset is a compile-time constant.
+  static void decode_packed(const char *packed, char *output) {
+    gather_packed(packed, output, std::make_index_sequence<length>{});
+  }
+};
+
+struct CodecKernels {
+  void (*encode)(std::string_view, char *);
+  void (*decode)(const char *, char *);
+  void (*decode_packed)(const char *, char *);
+};
+
+template <std::size_t... Index>
+constexpr std::array<CodecKernels, sizeof...(Index)> make_codec_kernels(
+    std::index_sequence<Index...>) {
+  return {{{&Codec<2 * Index + 3>::encode, &Codec<2 * Index + 3>::decode,
+            &Codec<2 * Index + 3>::decode_packed}...}};
+}
+
+// One Codec<N> instance for every odd grid size up to global_max_size,
+// indexed by (grid_size - 3) / 2.
+inline constexpr std::array<CodecKernels, (global_max_size - 1) / 2>
+    codec_kernels{make_codec_kernels(
+        std::make_index_sequence<(global_max_size - 1) / 2>{})};
+
+constexpr bool has_codec_kernels(int grid_size) {
+  return grid_size >= 3 && grid_size <= global_max_size && grid_size % 2 == 1;
+}
+
+// Number of equal-size messages decoded together by
+// DiamondCodec::decode_group.
+constexpr std::size_t decode_group_size{16};
+
+// Reasons a message cannot be encoded or decoded.
+enum class CodecError {
+  none,
+  message_too_long,
+  even_grid_size,
+  grid_too_small,
+  grid_too_large,
+  not_odd_square,
+  encoded_too_long,
+  below_minimum_grid,
+  packed_size_mismatch
+};
+
+inline const char *codec_error_message(CodecError error) {
+  switch (error) {
+    case CodecError::none:
+      return "\tNo error.";
+    case CodecError::message_too_long:
+    case CodecError::encoded_too_long:
+      return "\tEncoded message length must be <1000.";
+    case CodecError::even_grid_size:
+      return "\tGrid size must be an odd number.";
+    case CodecError::grid_too_small:
+      return "\tGrid size cannot hold the given message.";
+    case CodecError::grid_too_large:
+      return "\tMaximum grid size is 31x31.";
+    case CodecError::not_odd_square:
+      return "\tEncoded message length must be an odd square number.";
+    case CodecError::below_minimum_grid:
+      return "\tMinimum grid size is 3x3.";
+    default:
+      return "\tPacked grid has the wrong length.";
+  }
+}
+
+// The value of a codec call or the reason it failed, in the manner of
+// std::expected. Batch callers branch on it rather than paying for a throw
+// per bad line; value() throws the matching CustomException for callers
+// that prefer exceptions.
+template <typename T>
+class CodecResult {
+ private:
+  T value_;
+  CodecError error_;
+
+ public:
+  CodecResult(T value) : value_{std::move(value)}, error_{CodecError::none} {}
+  CodecResult(CodecError error) : value_{}, error_{error} {}
+
+  bool has_value() const { return error_ == CodecError::none; }
+  explicit operator bool() const { return has_value(); }
+  CodecError error() const { return error_; }
+
+  const T &value() const & {
+    if (!has_value()) {
+      throw CustomException(codec_error_message(error_));
+    }
+    return value_;
+  }
+
+  T &&value() && {
+    if (!has_value()) {
+      throw CustomException(codec_error_message(error_));
+    }
+    return std::move(value_);
+  }
+};
+
+// Allocation-free codec for embedding in other programs. Messages are read
+// from string views and written into caller-supplied buffers, sized up front
+// with encoded_size / decoded_size. Grid sizes with a Codec<N> instance use
+// its unrolled kernels; any other size walks the last cached path, so
+// steady-state calls perform no heap allocation or locking.
+class DiamondCodec {
+ private:
+  std::shared_ptr<PaddingSource> padding_source_;
+  int path_grid_size_;
+  std::shared_ptr<const std::vector<int>> path_;
+
+  const std::vector<int> &path_for(int grid_size) {
+    if (grid_size != path_grid_size_) {
+      path_ = PermutationCache::get_path(grid_size);
+      path_grid_size_ = grid_size;
+    }
+    return *path_;
+  }
+
+  // Smallest odd grid whose diamonds hold message_length characters; 1 for
+  // a message of up to one character.
+  static int smallest_grid_size(std::size_t message_length) {
+    int min_size{static_cast<int>(std::ceil(std::sqrt(message_length)))};
+    if (min_size % 2 == 0) {
+      ++min_size;
+    }
+    while (message_length > static_cast<std::size_t>(decoded_length(min_size))) {
+      min_size += 2;
+    }
+    return min_size;
+  }
+
+  static void check_capacity(std::size_t required, std::size_t capacity) {
+    if (capacity < required) {
+      throw CustomException("\tOutput buffer is too small.");
+    }
+  }
+
+ public:
+  DiamondCodec(std::shared_ptr<PaddingSource> padding_source =
+                   std::make_shared<FastPadding>())
+      : padding_source_{std::move(padding_source)},
+        path_grid_size_{0},
+        path_{nullptr} {}
+
+  void set_padding_source(std::shared_ptr<PaddingSource> padding_source) {
+    padding_source_ = std::move(padding_source);
+  }
+
+  // Grid size to encode a message of message_length characters into: the
+  // smallest that holds it when grid_size is 0, otherwise grid_size itself
+  // if it is odd and large enough. The smallest grid of a one-character
+  // message is 1x1, below the 3x3 minimum, so it is only encoded into an
+  // explicit grid_size. Constant time and never throws.
+  static CodecResult<int> check_encode(std::size_t message_length,
+                                       int grid_size = 0) {
+    if (message_length >
+        static_cast<std::size_t>(decoded_length(global_max_size))) {
+      return CodecError::message_too_long;
+    }
+    const int min_size{smallest_grid_size(message_length)};
+    if (grid_size == 0) {
+      grid_size = min_size;
+    } else if (grid_size % 2 == 0) {
+      return CodecError::even_grid_size;
+    }
+    if (grid_size < 3) {
+      return CodecError::below_minimum_grid;
+    }
+    if (grid_size > global_max_size) {
+      return CodecError::grid_too_large;
+    }
+    if (grid_size < min_size) {
+      return CodecError::grid_too_small;
+    }
+    return grid_size;
+  }
+
+  // Grid size of an encoded message, whose length must be the square of an
+  // odd size from 3 up. Constant time and never throws.
+  static CodecResult<int> check_decode(std::size_t encoded_length) {
+    const std::int64_t grid_size{
+        integer_sqrt(static_cast<std::int64_t>(encoded_length))};
+    if (static_cast<std::size_t>(grid_size * grid_size) != encoded_length ||
+        grid_size % 2 == 0) {
+      return CodecError::not_odd_square;
+    }
+    if (encoded_length > 999) {
+      return CodecError::encoded_too_long;
+    }
+    if (grid_size < 3) {
+      return CodecError::below_minimum_grid;
+    }
+    return static_cast<int>(grid_size);
+  }
+
+  // Smallest odd grid whose diamonds hold message_length characters, which
+  // is below 3x3 for a message of up to one character.
+  static int min_grid_size(std::size_t message_length) {
+    if (message_length >
+        static_cast<std::size_t>(decoded_length(global_max_size))) {
+      throw CustomException(codec_error_message(CodecError::message_too_long));
+    }
+    return smallest_grid_size(message_length);
+  }
+
+  static int encoded_grid_size(std::size_t encoded_length) {
+    return check_decode(encoded_length).value();
+  }
+
+  // A grid_size of 0 selects the smallest grid for the message.
+  static std::size_t encoded_size(std::size_t message_length,
+                                  int grid_size = 0) {
+    return square(grid_size != 0 ? grid_size : min_grid_size(message_length));
+  }
+
+  static std::size_t decoded_size(std::size_t encoded_length) {
+    return decoded_length(encoded_grid_size(encoded_length));
+  }
+
+  // The try_ calls report invalid input through their result; a buffer
+  // smaller than encoded_size / decoded_size still throws.
+  CodecResult<std::size_t> try_encode(std::string_view message, char *output,
+                                      std::size_t capacity,
+                                      int grid_size = 0) {
+    const CodecResult<int> checked_size{
+        check_encode(message.length(), grid_size)};
+    if (!checked_size) {
+      return checked_size.error();
+    }
+    grid_size = checked_size.value();
+    const std::size_t cell_count{static_cast<std::size_t>(square(grid_size))};
+    check_capacity(cell_count, capacity);
+
+    // Pad every cell in bulk, then scatter the message over its path. Spaces
+    // stay padding, as empty grid cells always have.
+    padding_source_->fill(output, cell_count,
+                          padding_source_->is_deterministic()
+                              ? hash_message(message, grid_size)
+                              : 0);
+    if (has_codec_kernels(grid_size)) {
+      codec_kernels[(grid_size - 3) / 2].encode(message, output);
+      return cell_count;
+    }
+    const std::vector<int> &path{path_for(grid_size)};
+    for (std::size_t index{0}; index < message.length(); index++) {
+      if (message[index] != ' ') {
+        output[path[index]] = message[index];
+      }
+    }
+    return cell_count;
+  }
+
+  std::size_t encode(std::string_view message, char *output,
+                     std::size_t capacity, int grid_size = 0) {
+    return try_encode(message, output, capacity, grid_size).value();
+  }
+
+  CodecResult<std::size_t> try_decode(std::string_view encoded_message,
+                                      char *output, std::size_t capacity) {
+    const CodecResult<int> checked_size{
+        check_decode(encoded_message.length())};
+    if (!checked_size) {
+      return checked_size.error();
+    }
+    const int grid_size{checked_size.value()};
+    if (has_codec_kernels(grid_size)) {
+      check_capacity(decoded_length(grid_size), capacity);
+      codec_kernels[(grid_size - 3) / 2].decode(encoded_message.data(), output);
+      return decoded_length(grid_size);
+    }
+    const std::vector<int> &path{path_for(grid_size)};
+    check_capacity(path.size(), capacity);
+    for (std::size_t index{0}; index < path.size(); index++) {
+      output[index] = encoded_message[path[index]];
+    }
+    return path.size();
+  }
+
+  std::size_t decode(std::string_view encoded_message, char *output,
+                     std::size_t capacity) {
+    return try_decode(encoded_message, output, capacity).value();
+  }
+
+  // Decodes a grid_size x grid_size grid held in packed form without
+  // unpacking it first.
+  static CodecResult<std::size_t> try_decode_packed(std::string_view packed,
+                                                    int grid_size,
+                                                    char *output,
+                                                    std::size_t capacity) {
+    const std::size_t cell_count{
+        grid_size > 0 ? static_cast<std::size_t>(grid_size) * grid_size : 0};
+    const CodecResult<int> checked_size{check_decode(cell_count)};
+    if (!checked_size) {
+      return checked_size.error();
+    }
+    if (packed.length() != packed_size(cell_count)) {
+      return CodecError::packed_size_mismatch;
+    }
+    check_capacity(decoded_length(grid_size), capacity);
+    codec_kernels[(grid_size - 3) / 2].decode_packed(packed.data(), output);
+    return decoded_length(grid_size);
+  }
+
+  // Decodes only the first `length` characters, reading them straight from
+  // their cells ring by ring without a path table.
+  static std::size_t decode_prefix(std::string_view encoded_message,
+                                   std::size_t length, char *output,
+                                   std::size_t capacity) {
+    const int grid_size{encoded_grid_size(encoded_message.length())};
+    const std::size_t prefix_length{std::min(
+        length, static_cast<std::size_t>(decoded_length(grid_size)))};
+    check_capacity(prefix_length, capacity);
+    const int centre{grid_size / 2};
+    const int strides[4]{1 - grid_size, grid_size + 1, grid_size - 1,
+                         -grid_size - 1};
+
+    std::size_t index{0};
+    for (int ring{0}; index < prefix_length; ring++) {
+      const int radius{centre - ring};
+      if (radius == 0) {
+        output[index++] = encoded_message[centre * grid_size + centre];
+        break;
+      }
+      const int starts[4]{centre * grid_size + ring, ring * grid_size + centre,
+                          centre * grid_size + centre + radius,
+                          (centre + radius) * grid_size + centre};
+      for (int side{0}; side < 4; side++) {
+        int cell{starts[side]};
+        for (int along{0}; along < radius && index < prefix_length; along++) {
+          output[index++] = encoded_message[cell];
+          cell += strides[side];
+        }
+      }
+    }
+    return prefix_length;
+  }
+
+  // Decodes up to decode_group_size encoded messages that all fill a
+  // grid_size x grid_size grid, writing decoded_length(grid_size) bytes to
+  // each output. The size is validated and the kernel chosen once for the
+  // whole group.
+  static void decode_group(int grid_size, const char *const *encoded_messages,
+                           char *const *outputs, std::size_t count) {
+    if (!has_codec_kernels(grid_size) || count > decode_group_size) {
+      throw CustomException("\tUnsupported batch decode.");
+    }
+    const CodecKernels &kernels{codec_kernels[(grid_size - 3) / 2]};
+    for (std::size_t lane{0}; lane < count; lane++) {
+      kernels.decode(encoded_messages[lane], outputs[lane]);
+    }
+  }
+
+  static char char_at(std::string_view encoded_message, int index) {
+    const int grid_size{encoded_grid_size(encoded_message.length())};
+    if (index < 0 || index >= decoded_length(grid_size)) {
+      throw CustomException("\tCharacter index is outside the message.");
+    }
+    return encoded_message[diamond_cell(grid_size, index)];
+  }
+};
+
+// An encoded message that follows edits to its plaintext. The padded grid is
+// kept, so an edit rewrites only the cells of the characters it moves or
+// changes, each found directly with diamond_cell. The grid is padded and
+// encoded afresh only when the message's smallest grid changes, i.e. its
+// length crosses a decoded_length boundary. A fresh grid matches
+// DiamondCodec::encode; later edits keep that grid's padding. Messages of up
+// to one character, which encode rejects, are kept in a 3x3 grid while
+// editing.
+class IncrementalEncoder {
+ private:
+  std::shared_ptr<PaddingSource> padding_source_;
+  std::string message_;
+  std::string padding_;
+  std::string encoded_message_;
+  int grid_size_;
+  std::size_t full_encode_count_;
+
+  void encode_grid(int grid_size) {
+    const std::size_t cell_count{static_cast<std::size_t>(square(grid_size))};
+    padding_.resize(cell_count);
+    padding_source_->fill(&padding_[0], cell_count,
+                          padding_source_->is_deterministic()
+                              ? hash_message(message_, grid_size)
+                              : 0);
+    encoded_message_ = padding_;
+    codec_kernels[(grid_size - 3) / 2].encode(message_, &encoded_message_[0]);
+    grid_size_ = grid_size;
+    full_encode_count_++;
+  }
+
+  void write_cell(std::size_t index) {
+    const int cell{diamond_cell(grid_size_, static_cast<int>(index))};
+    encoded_message_[cell] =
+        index < message_.length() && message_[index] != ' ' ? message_[index]
+                                                            : padding_[cell];
+  }
+
+  // Call once message_ has changed; characters from begin up to end may
+  // have moved, and any cells past the new length fall back to padding.
+  void update_cells(std::size_t begin, std::size_t end) {
+    const int grid_size{
+        std::max(DiamondCodec::min_grid_size(message_.length()), 3)};
+    if (grid_size != grid_size_) {
+      encode_grid(grid_size);
+      return;
+    }
+    for (std::size_t index{begin}; index < end; index++) {
+      write_cell(index);
+    }
+  }
+
+  void check_edit(std::size_t index, std::size_t count,
+                  std::size_t new_length) const {
+    if (index > message_.length() || count > message_.length() - index) {
+      throw CustomException("\tEdit is outside the message.");
+    }
+    DiamondCodec::min_grid_size(new_length);
+  }
+
+ public:
+  IncrementalEncoder(std::shared_ptr<PaddingSource> padding_source =
+                         std::make_shared<FastPadding>())
+      : padding_source_{std::move(padding_source)},
+        grid_size_{0},
+        full_encode_count_{0} {}
+
+  // Takes a whole new message. Only the cells from the first character that
+  // differs are rewritten when the grid size is unchanged.
+  void assign(std::string_view message) {
+    check_edit(0, 0, message.length());
+    const std::size_t old_length{message_.length()};
+    const std::size_t common{static_cast<std::size_t>(
+        std::mismatch(message_.begin(),
+                      message_.begin() + std::min(old_length, message.length()),
+                      message.begin())
+            .first -
+        message_.begin())};
+    message_.assign(message.data(), message.length());
+    update_cells(common, std::max(old_length, message_.length()));
+  }
+
+  void replace(std::size_t index, std::string_view text) {
+    check_edit(index, std::min(text.length(), message_.length() - index),
+               std::max(message_.length(), index + text.length()));
+    const std::size_t old_length{message_.length()};
+    message_.replace(index, std::min(text.length(), old_length - index), text);
+    update_cells(index, index + text.length());
+  }
+
+  void insert(std::size_t index, std::string_view text) {
+    check_edit(index, 0, message_.length() + text.length());
+    message_.insert(index, text.data(), text.length());
+    update_cells(index, message_.length());
+  }
+
+  void erase(std::size_t index, std::size_t count) {
+    check_edit(index, count, message_.length() - count);
+    const std::size_t old_length{message_.length()};
+    message_.erase(index, count);
+    update_cells(index, old_length);
+  }
+
+  void append(std::string_view text) { insert(message_.length(), text); }
+
+  std::string_view message() const { return message_; }
+  std::string_view encoded_message() const { return encoded_message_; }
+  int grid_size() const { return grid_size_; }
+
+  // Number of times a grid has been padded and encoded in full.
+  std::size_t full_encode_count() const { return full_encode_count_; }
+};
+
+// Streams arbitrarily long plaintexts through a series of diamond grids.
+// Each frame is a 6 byte little-endian header (grid size, payload length)
+// followed by the grid; a zero grid size terminates the stream. Payload bytes
+// are scattered verbatim, so the stream decodes back to the exact input.
+class StreamCodec {
+ private:
+  static constexpr char stream_magic_[4]{'D', 'M', 'S', '1'};
+  static constexpr int frame_header_size_{6};
+
+  int grid_size_;
+  std::shared_ptr<PaddingSource> padding_source_;
+
+  static int frame_grid_size(std::size_t payload_length) {
+    int size{static_cast<int>(std::ceil(std::sqrt(payload_length)))};
+    size = std::max(size + (size % 2 == 0 ? 1 : 0), 3);
+    while (static_cast<std::size_t>(decoded_length(size)) < payload_length) {
+      size += 2;
+    }
+    return size;
+  }
+
+  // Moves the first payload_length characters of the path between payload
+  // and frame: scattering them into the frame when encoding, gathering them
+  // back out when decoding. Large grids follow the tiled segments.
+  template <bool is_encoding>
+  static void permute(int grid_size, std::size_t payload_length, char *frame,
+                      char *payload) {
+    if (grid_size < blocked_min_size) {
+      const std::vector<int> &path{*PermutationCache::get_path(grid_size)};
+      for (std::size_t index{0}; index < payload_length; index++) {
+        if constexpr (is_encoding) {
+          frame[path[index]] = payload[index];
+        } else {
+          payload[index] = frame[path[index]];
+        }
+      }
+      return;
+    }
+    const std::vector<PathSegment> &segments{
+        *PermutationCache::get_blocked_path(grid_size)};
+    for (const PathSegment &segment : segments) {
+      if (segment.message_index >= payload_length) {
+        continue;
+      }
+      const std::size_t length{std::min<std::size_t>(
+          segment.length, payload_length - segment.message_index)};
+      char *cell{frame + segment.cell};
+      char *character{payload + segment.message_index};
+      for (std::size_t index{0}; index < length; index++) {
+        if constexpr (is_encoding) {
+          *cell = character[index];
+        } else {
+          character[index] = *cell;
+        }
+        cell += segment.stride;
+      }
+    }
+  }
+
+  void write_header(std::ostream &output, int grid_size,
+                    std::uint32_t payload_length) {
+    char header[frame_header_size_]{
+        static_cast<char>(grid_size & 0xFF),
+        static_cast<char>((grid_size >> 8) & 0xFF),
+        static_cast<char>(payload_length & 0xFF),
+        static_cast<char>((payload_length >> 8) & 0xFF),
+        static_cast<char>((payload_length >> 16) & 0xFF),
+        static_cast<char>((payload_length >> 24) & 0xFF)};
+    output.write(header, frame_header_size_);
+  }
+
+  bool read_header(std::istream &input, int &grid_size,
+                   std::uint32_t &payload_length) {
+    unsigned char header[frame_header_size_];
+    if (!input.read(reinterpret_cast<char *>(header), frame_header_size_)) {
+      return false;
+    }
+    grid_size = header[0] | (header[1] << 8);
+    payload_length = static_cast<std::uint32_t>(header[2]) |
+                     (static_cast<std::uint32_t>(header[3]) << 8) |
+                     (static_cast<std::uint32_t>(header[4]) << 16) |
+                     (static_cast<std::uint32_t>(header[5]) << 24);
+    return true;
+  }
+
+ public:
+  StreamCodec(int grid_size = stream_default_size,
+              std::shared_ptr<PaddingSource> padding_source =
+                  std::make_shared<FastPadding>())
+      : grid_size_{grid_size}, padding_source_{std::move(padding_source)} {
+    if (grid_size_ < 3 || grid_size_ > stream_max_size ||
+        grid_size_ % 2 == 0) {
+      throw CustomException(
+          "\tStream grid size must be an odd number between 3 and 4095.");
+    }
+  }
+
+  std::uintmax_t encode_stream(std::istream &input, std::ostream &output) {
+    const std::size_t chunk_length{
+        static_cast<std::size_t>(decoded_length(grid_size_))};
+    std::string chunk(chunk_length, '\0');
+    std::string frame;
+    std::uintmax_t total_bytes{0};
+
+    output.write(stream_magic_, sizeof(stream_magic_));
+    while (input) {
+      input.read(&chunk[0], chunk_length);
+      const std::size_t payload_length{
+          static_cast<std::size_t>(input.gcount())};
+      if (payload_length == 0) {
+        break;
+      }
+      const int grid_size{payload_length == chunk_length
+                              ? grid_size_
+                              : frame_grid_size(payload_length)};
+      frame.resize(square(grid_size));
+      padding_source_->fill(
+          &frame[0], frame.size(),
+          padding_source_->is_deterministic()
+              ? hash_message(std::string_view(chunk.data(), payload_length))
+              : 0);
+      constexpr bool is_encoding{true};
+      permute<is_encoding>(grid_size, payload_length, &frame[0], &chunk[0]);
+      write_header(output, grid_size,
+                   static_cast<std::uint32_t>(payload_length));
+      output.write(frame.data(), frame.size());
+      total_bytes += payload_length;
+    }
+    write_header(output, 0, 0);
+    if (!output) {
+      throw CustomException("\tError writing encoded stream.");
+    }
+    return total_bytes;
+  }
+
+  std::uintmax_t decode_stream(std::istream &input, std::ostream &output) {
+    char magic[sizeof(stream_magic_)];
+    if (!input.read(magic, sizeof(magic)) ||
+        !std::equal(magic, magic + sizeof(magic), stream_magic_)) {
+      throw CustomException("\tInput is not an encoded message stream.");
+    }
+
+    std::string frame;
+    std::string payload;
+    std::uintmax_t total_bytes{0};
+    int grid_size;
+    std::uint32_t payload_length;
+    while (read_header(input, grid_size, payload_length)) {
+      if (grid_size == 0) {
+        return total_bytes;
+      }
+      if (grid_size < 3 || grid_size > stream_max_size ||
+          grid_size % 2 == 0 ||
+          payload_length > static_cast<std::uint32_t>(
+                               decoded_length(grid_size))) {
+        throw CustomException("\tCorrupt frame header in encoded stream.");
+      }
+      frame.resize(square(grid_size));
+      if (!input.read(&frame[0], frame.size())) {
+        throw CustomException("\tEncoded stream ends mid-frame.");
+      }
+
+      payload.resize(payload_length);
+      constexpr bool is_encoding{false};
+      permute<is_encoding>(grid_size, payload_length, &frame[0], &payload[0]);
+      output.write(payload.data(), payload.size());
+      total_bytes += payload_length;
+    }
+    throw CustomException("\tEncoded stream is missing its end frame.");
+  }
+};
+
+#endif  // DIAMOND_CODEC_H
@@ -2,25 +2,477 @@
 // Designed and Developed by Kobi Chambers - Griffith University
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <limits>
+#include <list>
 #include <memory>
+#include <new>
+#include <mutex>
+#include <numeric>
 #include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-constexpr int global_max_size{static_cast<int>(std::sqrt(1000))};
-constexpr int square(int x) { return x * x; }
-constexpr int decoded_length(int x) { return (square(x) + 1) / 2; }
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "diamond_codec.h"
+
+// Heap allocation counting for the benchmark. Counting replaces the global
+// operator new / delete, which would route every allocation in the program
+// through the functions below, so it is only built into a benchmark build
+// compiled with -DENCRYPT_MESSAGES_COUNT_ALLOCATIONS; other builds keep the
+// standard allocator and report no allocation counts. The plain, aligned and
+// nothrow forms are all replaced, and the array forms forward to them. Even
+// when built in, counting is switched off unless a benchmark is running, so
+// worker threads never contend on the counter in normal use.
+std::atomic<bool> global_count_allocations{false};
+std::atomic<std::uint64_t> global_allocation_count{0};
+
+#if defined(ENCRYPT_MESSAGES_COUNT_ALLOCATIONS)
+constexpr bool is_counting_allocations{true};
+
+void *counted_allocation(std::size_t size, std::size_t alignment) noexcept {
+  if (global_count_allocations.load(std::memory_order_relaxed)) {
+    global_allocation_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  size = size == 0 ? 1 : size;
+  if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return std::malloc(size);
+  }
+  // aligned_alloc needs a size that is a multiple of the alignment.
+  return std::aligned_alloc(alignment,
+                            (size + alignment - 1) / alignment * alignment);
+}
+
+void *operator new(std::size_t size) {
+  if (void *memory{counted_allocation(size, 0)}) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  if (void *memory{
+          counted_allocation(size, static_cast<std::size_t>(alignment))}) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return counted_allocation(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+  return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+
+// Kept out of line so GCC does not pair the inlined free() with operator new
+// and warn about mismatched allocation functions.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void *memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+  ::operator delete(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+  ::operator delete(memory);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+  ::operator delete(memory);
+}
+
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept {
+  ::operator delete(memory);
+}
+
+void operator delete(void *memory, std::align_val_t,
+                     const std::nothrow_t &) noexcept {
+  ::operator delete(memory);
+}
+#else
+constexpr bool is_counting_allocations{false};
+#endif
+
+// Per-stage counters and latency histograms. Recording is switched off
+// unless --stats is given or the menu is running, so an unused recorder
+// costs a single relaxed load. Bucket b of a histogram counts events that
+// took [2^b, 2^(b+1)) nanoseconds.
+enum class Stage { load, normalise, encode, decode, pad, save };
+
+class Statistics {
+ private:
+  static constexpr int stage_count_{6};
+  static constexpr int bucket_count_{40};
+
+  struct alignas(64) StageCounters {
+    std::atomic<std::uint64_t> events{0};
+    std::atomic<std::uint64_t> bytes{0};
+    std::atomic<std::uint64_t> failures{0};
+    std::atomic<std::uint64_t> total_ns{0};
+    std::atomic<std::uint64_t> max_ns{0};
+    std::atomic<std::uint64_t> buckets[bucket_count_]{};
+  };
+
+  std::atomic<bool> is_enabled_;
+  std::chrono::steady_clock::time_point start_;
+  StageCounters stages_[stage_count_];
+  std::atomic<std::uint64_t> cache_hits_;
+  std::atomic<std::uint64_t> cache_misses_;
+  std::atomic<std::uint64_t> deduplicated_;
+
+  static const char *stage_name(int stage) {
+    constexpr const char *names[stage_count_]{"load",   "normalise", "encode",
+                                              "decode", "pad",       "save"};
+    return names[stage];
+  }
+
+  static int bucket_of(std::uint64_t ns) {
+    int bucket{0};
+    while (ns > 1 && bucket < bucket_count_ - 1) {
+      ns >>= 1;
+      ++bucket;
+    }
+    return bucket;
+  }
+
+  // Upper bound of the bucket holding the given fraction of recorded
+  // timings. A timing may cover several events, e.g. a block of lines.
+  static std::uint64_t percentile(const StageCounters &counters,
+                                  double fraction) {
+    std::uint64_t samples{0};
+    for (const auto &bucket : counters.buckets) {
+      samples += bucket.load(std::memory_order_relaxed);
+    }
+    const std::uint64_t target{
+        static_cast<std::uint64_t>(std::ceil(fraction * samples))};
+    std::uint64_t seen{0};
+    for (int bucket{0}; bucket < bucket_count_; bucket++) {
+      seen += counters.buckets[bucket].load(std::memory_order_relaxed);
+      if (seen >= target && seen > 0) {
+        return std::uint64_t{2} << bucket;
+      }
+    }
+    return 0;
+  }
+
+ public:
+  Statistics()
+      : is_enabled_{false},
+        start_{std::chrono::steady_clock::now()},
+        cache_hits_{0},
+        cache_misses_{0},
+        deduplicated_{0} {}
+
+  bool is_enabled() const {
+    return is_enabled_.load(std::memory_order_relaxed);
+  }
+
+  void enable() {
+    start_ = std::chrono::steady_clock::now();
+    is_enabled_.store(true, std::memory_order_relaxed);
+  }
+
+  void record(Stage stage, std::uint64_t ns, std::uint64_t bytes,
+              std::uint64_t events = 1) {
+    StageCounters &counters{stages_[static_cast<int>(stage)]};
+    counters.events.fetch_add(events, std::memory_order_relaxed);
+    counters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    counters.total_ns.fetch_add(ns, std::memory_order_relaxed);
+    counters.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    std::uint64_t max_ns{counters.max_ns.load(std::memory_order_relaxed)};
+    while (ns > max_ns && !counters.max_ns.compare_exchange_weak(
+                              max_ns, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  void record_failure(Stage stage) {
+    if (is_enabled()) {
+      stages_[static_cast<int>(stage)].failures.fetch_add(
+          1, std::memory_order_relaxed);
+    }
+  }
+
+  void record_cache_lookup(bool is_hit) {
+    if (is_enabled()) {
+      (is_hit ? cache_hits_ : cache_misses_)
+          .fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void record_deduplicated(std::uint64_t count) {
+    if (is_enabled()) {
+      deduplicated_.fetch_add(count, std::memory_order_relaxed);
+    }
+  }
+
+  // Peak resident set size, where the platform reports it.
+  static std::uint64_t peak_memory_bytes() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+  }
+
+  // Compact single-line totals of the codec stages for a live display.
+  std::string progress() const {
+    const std::chrono::duration<double> elapsed{
+        std::chrono::steady_clock::now() - start_};
+    std::ostringstream output;
+    output << std::fixed << std::setprecision(1);
+    for (Stage stage : {Stage::encode, Stage::decode}) {
+      const StageCounters &counters{stages_[static_cast<int>(stage)]};
+      const std::uint64_t events{counters.events.load(std::memory_order_relaxed)};
+      if (events == 0) {
+        continue;
+      }
+      output << stage_name(static_cast<int>(stage)) << ' ' << events
+             << " messages, "
+             << (elapsed.count() > 0
+                     ? counters.bytes.load(std::memory_order_relaxed) / 1e6 /
+                           elapsed.count()
+                     : 0.0)
+             << " MB/s, " << counters.failures.load(std::memory_order_relaxed)
+             << " failed | ";
+    }
+    output << elapsed.count() << "s, " << peak_memory_bytes() / 1e6 << " MB";
+    return output.str();
+  }
+
+  // One line per active stage: events, throughput, tail latency, failures.
+  std::string summary() const {
+    const std::chrono::duration<double> elapsed{
+        std::chrono::steady_clock::now() - start_};
+    std::ostringstream output;
+    output << std::fixed << std::setprecision(1);
+    for (int stage{0}; stage < stage_count_; stage++) {
+      const StageCounters &counters{stages_[stage]};
+      const std::uint64_t events{counters.events.load(std::memory_order_relaxed)};
+      if (events == 0) {
+        continue;
+      }
+      const double busy_s{
+          counters.total_ns.load(std::memory_order_relaxed) / 1e9};
+      output << '\t' << std::left << std::setw(10) << stage_name(stage)
+             << std::right << std::setw(10) << events << " events"
+             << std::setw(10)
+             << (busy_s > 0 ? counters.bytes.load(std::memory_order_relaxed) /
+                                  1e6 / busy_s
+                            : 0.0)
+             << " MB/s  p99 <" << percentile(counters, 0.99) / 1e3 << "us  "
+             << counters.failures.load(std::memory_order_relaxed)
+             << " failed\n";
+    }
+    const std::uint64_t cache_hits{cache_hits_.load(std::memory_order_relaxed)};
+    const std::uint64_t cache_misses{
+        cache_misses_.load(std::memory_order_relaxed)};
+    const std::uint64_t deduplicated{
+        deduplicated_.load(std::memory_order_relaxed)};
+    if (cache_hits + cache_misses + deduplicated > 0) {
+      output << "\tcache " << cache_hits << " hits, " << cache_misses
+             << " misses, " << deduplicated << " duplicate lines\n";
+    }
+    output << "\telapsed " << elapsed.count() << "s, peak memory "
+           << peak_memory_bytes() / 1e6 << " MB\n";
+    return output.str();
+  }
+
+  void report_json(std::ostream &output) const {
+    const std::chrono::duration<double> elapsed{
+        std::chrono::steady_clock::now() - start_};
+    output << "{\"elapsed_s\": " << elapsed.count()
+           << ", \"peak_memory_bytes\": " << peak_memory_bytes()
+           << ", \"cache\": {\"hits\": "
+           << cache_hits_.load(std::memory_order_relaxed) << ", \"misses\": "
+           << cache_misses_.load(std::memory_order_relaxed)
+           << ", \"deduplicated\": "
+           << deduplicated_.load(std::memory_order_relaxed)
+           << "}, \"stages\": [";
+    for (int stage{0}; stage < stage_count_; stage++) {
+      const StageCounters &counters{stages_[stage]};
+      const std::uint64_t events{counters.events.load(std::memory_order_relaxed)};
+      const std::uint64_t total_ns{
+          counters.total_ns.load(std::memory_order_relaxed)};
+      output << (stage == 0 ? "\n" : ",\n") << "  {\"name\": \""
+             << stage_name(stage) << "\", \"events\": " << events
+             << ", \"bytes\": " << counters.bytes.load(std::memory_order_relaxed)
+             << ", \"failures\": "
+             << counters.failures.load(std::memory_order_relaxed)
+             << ", \"total_ns\": " << total_ns << ", \"mean_ns\": "
+             << (events > 0 ? total_ns / events : 0)
+             << ", \"p50_ns\": " << percentile(counters, 0.5)
+             << ", \"p99_ns\": " << percentile(counters, 0.99)
+             << ", \"max_ns\": "
+             << counters.max_ns.load(std::memory_order_relaxed)
+             << ", \"histogram\": {";
+      bool is_first_bucket{true};
+      for (int bucket{0}; bucket < bucket_count_; bucket++) {
+        const std::uint64_t count{
+            counters.buckets[bucket].load(std::memory_order_relaxed)};
+        if (count != 0) {
+          output << (is_first_bucket ? "" : ", ") << '"'
+                 << (std::uint64_t{2} << bucket) << "\": " << count;
+          is_first_bucket = false;
+        }
+      }
+      output << "}}";
+    }
+    output << "\n]}\n";
+  }
+};
+
+Statistics global_statistics;
+
+// Records the lifetime of a scope against a stage when statistics are on.
+class StageTimer {
+ private:
+  Stage stage_;
+  std::uint64_t bytes_;
+  std::uint64_t events_;
+  bool is_active_;
+  std::chrono::steady_clock::time_point start_;
+
+ public:
+  StageTimer(Stage stage, std::uint64_t bytes = 0, std::uint64_t events = 1)
+      : stage_{stage},
+        bytes_{bytes},
+        events_{events},
+        is_active_{global_statistics.is_enabled()} {
+    if (is_active_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  StageTimer(const StageTimer &) = delete;
+  StageTimer &operator=(const StageTimer &) = delete;
+
+  ~StageTimer() {
+    if (is_active_) {
+      const auto elapsed{std::chrono::steady_clock::now() - start_};
+      global_statistics.record(
+          stage_,
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+          bytes_, events_);
+    }
+  }
+
+  void set_bytes(std::uint64_t bytes) { bytes_ = bytes; }
+
+  void set_events(std::uint64_t events) { events_ = events; }
+};
+
+// Prints Statistics::progress to stderr once a second until stopped. On a
+// terminal the line is redrawn in place; otherwise each update is logged.
+class ProgressReporter {
+ private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool is_stopped_;
+  bool has_reported_;
+  std::thread thread_;
+
+  static bool is_terminal() {
+#if defined(__unix__) || defined(__APPLE__)
+    return ::isatty(STDERR_FILENO) != 0;
+#else
+    return false;
+#endif
+  }
+
+  void report() {
+    const char line_end{is_terminal() ? '\r' : '\n'};
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!condition_.wait_for(lock, std::chrono::seconds(1),
+                                [this] { return is_stopped_; })) {
+      std::cerr << global_statistics.progress() << line_end << std::flush;
+      has_reported_ = true;
+    }
+  }
+
+ public:
+  ProgressReporter()
+      : is_stopped_{false},
+        has_reported_{false},
+        thread_{&ProgressReporter::report, this} {}
+
+  ProgressReporter(const ProgressReporter &) = delete;
+  ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+  ~ProgressReporter() { stop(); }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      is_stopped_ = true;
+    }
+    condition_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+      if (has_reported_ && is_terminal()) {
+        std::cerr << '\n';
+      }
+    }
+  }
+};
 
 void clear_input_buffer() {
   std::cin.clear();
@@ -46,149 +498,351 @@ const char get_user_choice(const std::string message_to_user) {
 }
 
 bool is_valid_utf8(char c) {
-  return !(c >= 0xC0 && c <= 0xC1) && !(c >= 0xF5 && c <= 0xFF);
+  const unsigned char byte{static_cast<unsigned char>(c)};
+  return !(byte >= 0xC0 && byte <= 0xC1) && !(byte >= 0xF5);
 }
 
-std::string sanitise_non_utf8(const std::string &input) {
-  std::string sanitised;
-  std::copy_if(input.begin(), input.end(), std::back_inserter(sanitised),
-               is_valid_utf8);
-  return sanitised;
+// Message normalisation drops bytes that never appear in UTF-8 and
+// upper-cases ASCII letters in a single pass, returning the new length.
+// Bytes are only written when they change so untouched pages of a mapped
+// file are never copied.
+std::size_t normalise_scalar(char *message, std::size_t length,
+                             std::size_t input = 0, std::size_t output = 0) {
+  for (; input < length; input++) {
+    const char ch{message[input]};
+    if (!is_valid_utf8(ch)) {
+      continue;
+    }
+    const char upper_ch{(ch >= 'a' && ch <= 'z') ? (char)(ch - 'a' + 'A') : ch};
+    if (output != input || upper_ch != ch) {
+      message[output] = upper_ch;
+    }
+    ++output;
+  }
+  return output;
 }
 
-class CustomException : public std::exception {
- private:
-  std::string exception_message_;
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
 
- public:
-  CustomException(const char *msg) : exception_message_{msg} {}
+// Vector kernels handle any block free of invalid bytes directly and hand
+// the rest of the message to the scalar loop at the first block that needs
+// bytes removed.
+std::size_t normalise_sse2(char *message, std::size_t length) {
+  const __m128i lower_bias{_mm_set1_epi8(0x80 - 'a')};
+  const __m128i lower_limit{_mm_set1_epi8(-128 + 26)};
+  const __m128i case_bit{_mm_set1_epi8(0x20)};
+  const __m128i invalid_floor{_mm_set1_epi8((char)0xF5)};
+  const __m128i lead_mask{_mm_set1_epi8((char)0xFE)};
+  const __m128i overlong_lead{_mm_set1_epi8((char)0xC0)};
 
-  const char *what() const noexcept override {
-    return exception_message_.c_str();
+  std::size_t input{0};
+  for (; input + 16 <= length; input += 16) {
+    __m128i block{_mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(message + input))};
+    const __m128i invalid{_mm_or_si128(
+        _mm_cmpeq_epi8(_mm_max_epu8(block, invalid_floor), block),
+        _mm_cmpeq_epi8(_mm_and_si128(block, lead_mask), overlong_lead))};
+    if (_mm_movemask_epi8(invalid) != 0) {
+      return normalise_scalar(message, length, input, input);
+    }
+    const __m128i lower{
+        _mm_cmplt_epi8(_mm_add_epi8(block, lower_bias), lower_limit)};
+    if (_mm_movemask_epi8(lower) != 0) {
+      block = _mm_xor_si128(block, _mm_and_si128(lower, case_bit));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(message + input), block);
+    }
   }
-};
+  return normalise_scalar(message, length, input, input);
+}
 
-class GridBoundary {
- private:
-  int top_, bottom_, right_;
+TARGET_AVX2 std::size_t normalise_avx2(char *message, std::size_t length) {
+  const __m256i lower_bias{_mm256_set1_epi8(0x80 - 'a')};
+  const __m256i lower_limit{_mm256_set1_epi8(-128 + 26)};
+  const __m256i case_bit{_mm256_set1_epi8(0x20)};
+  const __m256i invalid_floor{_mm256_set1_epi8((char)0xF5)};
+  const __m256i lead_mask{_mm256_set1_epi8((char)0xFE)};
+  const __m256i overlong_lead{_mm256_set1_epi8((char)0xC0)};
 
- public:
-  GridBoundary(int top, int bottom, int right)
-      : top_{top}, bottom_{bottom}, right_{right} {}
+  std::size_t input{0};
+  for (; input + 32 <= length; input += 32) {
+    __m256i block{_mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(message + input))};
+    const __m256i invalid{_mm256_or_si256(
+        _mm256_cmpeq_epi8(_mm256_max_epu8(block, invalid_floor), block),
+        _mm256_cmpeq_epi8(_mm256_and_si256(block, lead_mask), overlong_lead))};
+    if (_mm256_movemask_epi8(invalid) != 0) {
+      return normalise_scalar(message, length, input, input);
+    }
+    const __m256i lower{
+        _mm256_cmpgt_epi8(lower_limit, _mm256_add_epi8(block, lower_bias))};
+    if (_mm256_movemask_epi8(lower) != 0) {
+      block = _mm256_xor_si256(block, _mm256_and_si256(lower, case_bit));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(message + input), block);
+    }
+  }
+  return normalise_scalar(message, length, input, input);
+}
 
-  void manipulate_boundary() {
-    ++top_;
-    --bottom_;
-    --right_;
+bool cpu_supports_avx2() {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_cpu_supports("avx2");
+#else
+  int registers[4];
+  __cpuid(registers, 0);
+  if (registers[0] < 7) {
+    return false;
   }
+  __cpuid(registers, 1);
+  const bool has_os_ymm_support{(registers[2] & (1 << 27)) != 0 &&
+                                (_xgetbv(0) & 0x6) == 0x6};
+  __cpuidex(registers, 7, 0);
+  return has_os_ymm_support && (registers[1] & (1 << 5)) != 0;
+#endif
+}
+#endif
 
-  bool within_row_bounds(int row) const {
-    return (row > top_ && row < bottom_);
+using NormaliseKernel = std::size_t (*)(char *, std::size_t);
+
+NormaliseKernel select_normalise_kernel() {
+#if defined(__x86_64__) || defined(_M_X64)
+  return cpu_supports_avx2() ? normalise_avx2 : normalise_sse2;
+#else
+  return [](char *message, std::size_t length) {
+    return normalise_scalar(message, length);
+  };
+#endif
+}
+
+std::size_t normalise_in_place(char *message, std::size_t length) {
+  static const NormaliseKernel kernel{select_normalise_kernel()};
+  return kernel(message, length);
+}
+
+// Packing to and from the five-bit form of diamond_codec.h. Only text made
+// entirely of 'A'-'Z' can be packed.
+bool is_packable(std::string_view text) {
+  bool is_letters{true};
+  for (const char ch : text) {
+    is_letters &= static_cast<unsigned char>(ch - 'A') < 26;
   }
+  return is_letters;
+}
 
-  bool within_col_bounds(int col) const { return col < right_; }
+// The scalar kernels start at a multiple of eight letters, so the vector
+// kernels can hand them whatever tail is left.
+void pack_scalar(const char *text, std::size_t length, char *packed,
+                 std::size_t input = 0) {
+  char *output{packed + input / 8 * 5};
+  std::uint32_t bits{0};
+  int bit_count{0};
+  for (; input < length; input++) {
+    bits |= static_cast<std::uint32_t>(text[input] - 'A') << bit_count;
+    bit_count += 5;
+    if (bit_count >= 8) {
+      *output++ = static_cast<char>(bits);
+      bits >>= 8;
+      bit_count -= 8;
+    }
+  }
+  if (bit_count > 0) {
+    *output = static_cast<char>(bits);
+  }
+}
 
-  bool is_within_boundary(int row, int col) const {
-    return (within_row_bounds(row) && within_col_bounds(col));
+void unpack_scalar(const char *packed, std::size_t length, char *text,
+                   std::size_t output = 0) {
+  for (; output < length; output++) {
+    text[output] = packed_letter(packed, output);
   }
-};
+}
 
-class GridOperations {
- private:
-  int grid_size_;
-  std::unique_ptr<std::unique_ptr<char[]>[]> grid_;
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_BMI2 __attribute__((target("bmi2")))
+#else
+#define TARGET_BMI2
+#endif
 
-  void initialise_grid(const std::string message) {
-    int index{0};
-    for (int i{0}; i < grid_size_; i++) {
-      for (int j{0}; j < grid_size_; j++) {
-        grid_[i][j] = (message != "") ? message[index++] : ' ';
-      }
-    }
+// With BMI2, pext gathers the low five bits of eight letters into forty
+// contiguous bits and pdep spreads them back out.
+constexpr std::uint64_t letter_bias{0x4141414141414141ull};
+constexpr std::uint64_t letter_mask{0x1F1F1F1F1F1F1F1Full};
+
+TARGET_BMI2 void pack_bmi2(const char *text, std::size_t length,
+                           char *packed) {
+  std::size_t input{0};
+  for (; input + 8 <= length; input += 8) {
+    std::uint64_t letters;
+    std::memcpy(&letters, text + input, 8);
+    const std::uint64_t bits{_pext_u64(letters - letter_bias, letter_mask)};
+    std::memcpy(packed + input / 8 * 5, &bits, 5);
   }
+  pack_scalar(text, length, packed, input);
+}
 
-  void fill_grid(const std::string &message, const bool encode_flag,
-                 std::string *decoded_message) {
-    const int swap{-1};
-    const int max_decoded_length{decoded_length(grid_size_)};
+TARGET_BMI2 void unpack_bmi2(const char *packed, std::size_t length,
+                             char *text) {
+  std::size_t output{0};
+  for (; output + 8 <= length; output += 8) {
+    std::uint64_t bits{0};
+    std::memcpy(&bits, packed + output / 8 * 5, 5);
+    const std::uint64_t letters{_pdep_u64(bits, letter_mask) + letter_bias};
+    std::memcpy(text + output, &letters, 8);
+  }
+  unpack_scalar(packed, length, text, output);
+}
 
-    GridBoundary boundary{0, grid_size_ - 1, grid_size_ - 1};
-    int index{0};
-    int row{grid_size_ / 2};
-    int col{0};
-    int row_manip{-1};
-    int col_manip{1};
-    while (index < message.length()) {
-      if (encode_flag) {
-        grid_[row][col] = message[index++];
-      } else if (index >= max_decoded_length) {
-        break;
-      } else {
-        *decoded_message += grid_[row][col];
-        grid_[row][col] = '~';
-        ++index;
-      }
-      if (!boundary.within_row_bounds(row)) {
-        row_manip *= swap;
-      }
-      if (!boundary.within_col_bounds(col)) {
-        col_manip *= swap;
-      }
+bool cpu_supports_bmi2() {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_cpu_supports("bmi2");
+#else
+  int registers[4];
+  __cpuid(registers, 0);
+  if (registers[0] < 7) {
+    return false;
+  }
+  __cpuidex(registers, 7, 0);
+  return (registers[1] & (1 << 8)) != 0;
+#endif
+}
+#endif
 
-      row += row_manip;
-      col += col_manip;
-      if (((encode_flag && grid_[row][col] != ' ') ||
-           (!encode_flag && grid_[row][col] == '~')) &&
-          boundary.is_within_boundary(row, col)) {
-        ++col;
-        col_manip *= swap;
-        boundary.manipulate_boundary();
-      }
-    }
+using PackKernel = void (*)(const char *, std::size_t, char *);
+
+PackKernel select_pack_kernel(bool is_packing) {
+#if defined(__x86_64__) || defined(_M_X64)
+  if (cpu_supports_bmi2()) {
+    return is_packing ? pack_bmi2 : unpack_bmi2;
   }
+#endif
+  if (is_packing) {
+    return [](const char *text, std::size_t length, char *packed) {
+      pack_scalar(text, length, packed);
+    };
+  }
+  return [](const char *packed, std::size_t length, char *text) {
+    unpack_scalar(packed, length, text);
+  };
+}
+
+// Writes packed_size(text.length()) bytes to packed.
+void pack_letters(std::string_view text, char *packed) {
+  static const PackKernel kernel{select_pack_kernel(true)};
+  kernel(text.data(), text.length(), packed);
+}
+
+// Writes length letters to text.
+void unpack_letters(const char *packed, std::size_t length, char *text) {
+  static const PackKernel kernel{select_pack_kernel(false)};
+  kernel(packed, length, text);
+}
+
+// Bounded least-recently-used results, keyed by a hash of the mode, grid
+// size and input. A hit is confirmed against the stored input, so hash
+// collisions never return another message's result. Not thread-safe: each
+// EncoderDecoder owns its own cache.
+class ResultCache {
+ private:
+  struct Entry {
+    std::uint64_t key;
+    std::string input;
+    std::string result;
+  };
+
+  std::size_t capacity_;
+  std::list<Entry> entries_;
+  std::unordered_map<std::uint64_t, std::list<Entry>::iterator> index_;
+  std::uint64_t hits_;
+  std::uint64_t misses_;
 
  public:
-  GridOperations() : grid_size_{0}, grid_{nullptr} {}
+  enum class Mode { encode, decode };
+
+  ResultCache(std::size_t capacity)
+      : capacity_{std::max<std::size_t>(capacity, 1)}, hits_{0}, misses_{0} {
+    index_.reserve(capacity_);
+  }
+
+  static std::uint64_t key_of(Mode mode, int grid_size,
+                              std::string_view input) {
+    return hash_message(input, (static_cast<std::uint64_t>(grid_size) << 1) |
+                                   static_cast<std::uint64_t>(mode));
+  }
 
-  void set_grid_size(int size) {
-    if (size < 3) {
-      throw CustomException("\tMinimum grid size is 3x3.");
+  // The cached result, refreshed as most recently used, or nullptr.
+  const std::string *find(std::uint64_t key, std::string_view input) {
+    const auto found{index_.find(key)};
+    const bool is_hit{found != index_.end() && found->second->input == input};
+    is_hit ? ++hits_ : ++misses_;
+    global_statistics.record_cache_lookup(is_hit);
+    if (!is_hit) {
+      return nullptr;
     }
-    if (size % 2 == 0) {
-      throw CustomException("\tGrid size must be an odd number.");
+    entries_.splice(entries_.begin(), entries_, found->second);
+    return &found->second->result;
+  }
+
+  // Stores a result, recycling the least recently used entry once full.
+  void insert(std::uint64_t key, std::string_view input,
+              const std::string &result) {
+    const auto found{index_.find(key)};
+    if (found != index_.end()) {
+      entries_.erase(found->second);
+      index_.erase(found);
     }
-    grid_size_ = size;
-    grid_ = std::make_unique<std::unique_ptr<char[]>[]>(grid_size_);
-    for (int i{0}; i < grid_size_; i++) {
-      grid_[i] = std::make_unique<char[]>(grid_size_);
+    if (entries_.size() == capacity_) {
+      index_.erase(entries_.back().key);
+      entries_.splice(entries_.begin(), entries_, std::prev(entries_.end()));
+    } else {
+      entries_.emplace_front();
     }
+    Entry &entry{entries_.front()};
+    entry.key = key;
+    entry.input.assign(input.data(), input.length());
+    entry.result = result;
+    index_[key] = entries_.begin();
   }
 
-  void process_grid(const std::string &message, const bool encode_flag,
-                    std::string *decoded_message) {
-    encode_flag ? initialise_grid("") : initialise_grid(message);
-    fill_grid(message, encode_flag, decoded_message);
+  void clear() {
+    entries_.clear();
+    index_.clear();
   }
 
-  std::string get_encoded_message() {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<int> distribution('A', 'Z');
+  std::uint64_t hits() const { return hits_; }
 
-    std::string encoded_message;
-    for (int i{0}; i < grid_size_; i++) {
-      for (int j{0}; j < grid_size_; j++) {
-        encoded_message +=
-            (grid_[i][j] == ' ') ? (char)(distribution(gen)) : grid_[i][j];
-      }
-    }
-    return encoded_message;
+  std::uint64_t misses() const { return misses_; }
+};
+
+// Times each bulk padding fill of the wrapped source as the pad stage.
+class TimedPadding : public PaddingSource {
+ private:
+  std::shared_ptr<PaddingSource> padding_source_;
+
+ public:
+  TimedPadding(std::shared_ptr<PaddingSource> padding_source)
+      : padding_source_{std::move(padding_source)} {}
+
+  void fill(char *padding, std::size_t count,
+            std::uint64_t message_key) override {
+    StageTimer timer{Stage::pad, count};
+    padding_source_->fill(padding, count, message_key);
+  }
+
+  bool is_deterministic() const override {
+    return padding_source_->is_deterministic();
   }
 };
 
 class EncoderDecoder {
  private:
-  std::shared_ptr<GridOperations> grid_operations_;
+  std::shared_ptr<DiamondCodec> codec_;
+  std::shared_ptr<ResultCache> result_cache_;
+  bool is_deterministic_padding_;
 
   constexpr bool is_even(int x) { return x % 2 == 0; }
 
@@ -216,504 +870,3715 @@ class EncoderDecoder {
   }
 
  public:
-  EncoderDecoder() : grid_operations_{std::make_shared<GridOperations>()} {}
+  EncoderDecoder()
+      : codec_{std::make_shared<DiamondCodec>(
+            std::make_shared<TimedPadding>(std::make_shared<FastPadding>()))},
+        result_cache_{nullptr},
+        is_deterministic_padding_{false} {}
+
+  void set_padding_source(std::shared_ptr<PaddingSource> padding_source) {
+    is_deterministic_padding_ = padding_source->is_deterministic();
+    codec_->set_padding_source(
+        std::make_shared<TimedPadding>(std::move(padding_source)));
+    if (result_cache_) {
+      result_cache_->clear();
+    }
+  }
 
-  std::string encode(const std::string &message,
-                     bool is_auto_grid_size = false) {
-    int min_size{static_cast<int>(std::ceil(std::sqrt(message.length())))};
-    if (is_even(min_size)) {
-      ++min_size;
+  // Decodes are always cacheable; encodes only with deterministic padding,
+  // as a cached encode repeats the padding of the first.
+  void set_result_cache(std::shared_ptr<ResultCache> result_cache) {
+    result_cache_ = std::move(result_cache);
+  }
+
+  std::string encode(std::string_view message, bool is_auto_grid_size = false) {
+    const int min_size{DiamondCodec::min_grid_size(message.length())};
+    if (is_auto_grid_size) {
+      return encode(message, min_size);
     }
-    int max_decoded_length{decoded_length(min_size)};
-    while (message.length() > max_decoded_length) {
-      min_size += 2;
-      max_decoded_length = decoded_length(min_size);
+    const int grid_size{prompt_grid_size(min_size)};
+    clear_input_buffer();
+    return encode(message, grid_size);
+  }
+
+  // The try_ calls validate the input up front and return the error instead
+  // of throwing, for batch callers that expect invalid lines. A grid_size of
+  // 0 selects the smallest grid.
+  CodecResult<std::string> try_encode(std::string_view message,
+                                      int grid_size) {
+    StageTimer timer{Stage::encode, message.length()};
+    const CodecResult<int> checked_size{
+        DiamondCodec::check_encode(message.length(), grid_size)};
+    if (!checked_size) {
+      return checked_size.error();
     }
-    if (square(min_size) > 999) {
-      throw CustomException("\tEncoded message length must be <1000.");
+    grid_size = checked_size.value();
+    const bool is_cacheable{result_cache_ && is_deterministic_padding_};
+    std::uint64_t key{0};
+    if (is_cacheable) {
+      key = ResultCache::key_of(ResultCache::Mode::encode, grid_size, message);
+      if (const std::string *result{result_cache_->find(key, message)}) {
+        return *result;
+      }
     }
-    if (is_auto_grid_size) {
-      grid_operations_->set_grid_size(min_size);
-    } else {
-      grid_operations_->set_grid_size(prompt_grid_size(min_size));
-      clear_input_buffer();
+    std::string encoded_message(square(grid_size), '\0');
+    codec_->encode(message, &encoded_message[0], encoded_message.size(),
+                   grid_size);
+    if (is_cacheable) {
+      result_cache_->insert(key, message, encoded_message);
     }
+    return encoded_message;
+  }
 
-    constexpr bool encode_flag{true};
-    grid_operations_->process_grid(message, encode_flag, nullptr);
-    return grid_operations_->get_encoded_message();
+  std::string encode(std::string_view message, int grid_size) {
+    return try_encode(message, grid_size).value();
   }
 
-  std::string decode(const std::string &encoded_message) {
-    int grid_size{static_cast<int>(std::sqrt(encoded_message.length()))};
-    if (is_even(grid_size)) {
-      throw CustomException(
-          "\tEncoded message length must be an odd square number.");
+  CodecResult<std::string> try_decode(std::string_view encoded_message) {
+    StageTimer timer{Stage::decode, encoded_message.length()};
+    const CodecResult<int> checked_size{
+        DiamondCodec::check_decode(encoded_message.length())};
+    if (!checked_size) {
+      return checked_size.error();
     }
-    if (encoded_message.length() > 999) {
-      throw CustomException("\tEncoded message length must be <1000.");
+    std::uint64_t key{0};
+    if (result_cache_) {
+      key = ResultCache::key_of(ResultCache::Mode::decode, 0, encoded_message);
+      if (const std::string *result{
+              result_cache_->find(key, encoded_message)}) {
+        return *result;
+      }
+    }
+    std::string decoded_message(decoded_length(checked_size.value()), '\0');
+    codec_->decode(encoded_message, &decoded_message[0],
+                   decoded_message.size());
+    if (result_cache_) {
+      result_cache_->insert(key, encoded_message, decoded_message);
     }
-
-    grid_operations_->set_grid_size(grid_size);
-    constexpr bool encode_flag{false};
-    std::string decoded_message;
-    grid_operations_->process_grid(encoded_message, encode_flag,
-                                   &decoded_message);
     return decoded_message;
   }
-};
 
-class FileOperations {
- private:
-  std::unordered_set<std::string> get_directory_files() {
-    std::unordered_set<std::string> cwd_files;
-    for (const auto &entry : std::filesystem::directory_iterator(".")) {
-      cwd_files.insert(entry.path().filename().string());
+  std::string decode(std::string_view encoded_message) {
+    return try_decode(encoded_message).value();
+  }
+
+  CodecResult<std::string> try_decode_prefix(std::string_view encoded_message,
+                                             int length) {
+    StageTimer timer{Stage::decode, encoded_message.length()};
+    const CodecResult<int> checked_size{
+        DiamondCodec::check_decode(encoded_message.length())};
+    if (!checked_size) {
+      return checked_size.error();
     }
-    return cwd_files;
+    std::string decoded_message(
+        std::min(static_cast<std::size_t>(std::max(length, 0)),
+                 static_cast<std::size_t>(
+                     decoded_length(checked_size.value()))),
+        '\0');
+    DiamondCodec::decode_prefix(encoded_message, decoded_message.size(),
+                                &decoded_message[0], decoded_message.size());
+    return decoded_message;
   }
 
-  bool file_exists(const std::string &file_name,
-                   const std::unordered_set<std::string> &cwd_files) {
-    return cwd_files.find(file_name) != cwd_files.end();
+  std::string decode_prefix(std::string_view encoded_message, int length) {
+    return try_decode_prefix(encoded_message, length).value();
   }
 
-  std::string generate_default_file_name(int &default_iter) {
-    std::stringstream ss;
-    ss << std::setw(2) << std::setfill('0') << default_iter++;
-    return "default_" + ss.str() + ".txt";
+  char char_at(std::string_view encoded_message, int index) {
+    return DiamondCodec::char_at(encoded_message, index);
   }
+};
 
-  std::string prompt_file_name(const std::unordered_set<std::string> cwd_files,
-                               const bool is_new_file) {
-    std::string file_name;
-    std::cout
-        << "Enter the filename (leave empty for default, 'menu' to return): ";
-    std::getline(std::cin, file_name);
+// Runs indexed jobs on a set of worker threads. Jobs are sorted by estimated
+// cost and dealt out in blocks, most expensive first, to per-worker queues;
+// a worker that runs dry steals the cheapest remaining block of another.
+class WorkStealingPool {
+ private:
+  struct JobBlock {
+    std::size_t begin;
+    std::size_t end;
+  };
 
-    int default_iter{0};
-    if (file_name.empty()) {
-      std::cout << "\tSearching for default filenames..." << '\n';
-      file_name = "default_00.txt";
-      ++default_iter;
-    } else if (string_to_upper(file_name) == "MENU") {
-      throw CustomException("\tReturning to main menu...");
-    }
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<JobBlock> blocks;
+  };
 
-    while ((default_iter > 0 && is_new_file &&
-            file_exists(file_name, cwd_files) && default_iter < 100) ||
-           (default_iter > 0 && !is_new_file &&
-            !file_exists(file_name, cwd_files) && default_iter < 100)) {
-      file_name = generate_default_file_name(default_iter);
-    }
-    return file_name;
-  }
+  std::size_t thread_count_;
 
-  std::string get_new_file_name() {
-    const std::unordered_set<std::string> cwd_files{get_directory_files()};
-    constexpr bool is_new_file{true};
-    clear_input_buffer();
-    while (true) {
-      std::string file_name{prompt_file_name(cwd_files, is_new_file)};
-      if (!file_exists(file_name, cwd_files)) {
-        return file_name;
+  static bool take_block(std::vector<WorkQueue> &queues, std::size_t worker,
+                         JobBlock &block) {
+    {
+      std::lock_guard<std::mutex> lock(queues[worker].mutex);
+      if (!queues[worker].blocks.empty()) {
+        block = queues[worker].blocks.front();
+        queues[worker].blocks.pop_front();
+        return true;
       }
-      if (get_user_choice(
-              "File already exists. Do you want to overwrite? (y/n): ") ==
-          'Y') {
-        return file_name;
+    }
+    for (std::size_t offset{1}; offset < queues.size(); offset++) {
+      WorkQueue &victim{queues[(worker + offset) % queues.size()]};
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.blocks.empty()) {
+        block = victim.blocks.back();
+        victim.blocks.pop_back();
+        return true;
       }
-      std::cout << "Enter a new filename.\n";
-      clear_input_buffer();
     }
+    return false;
   }
 
-  std::string get_existing_file_name() {
-    std::cout << "Contents of current directory:\n";
-    const std::unordered_set<std::string> cwd_files{get_directory_files()};
-    const std::string program_name{
-        std::filesystem::path(__FILE__).filename().string()};
-    const std::string executable_name{
-        std::filesystem::path(__argv[0]).filename().string()};
-    for (auto file : cwd_files) {
-      if (file != program_name && file != executable_name) {
-        std::cout << file << '\n';
-      }
+ public:
+  WorkStealingPool(std::size_t thread_count)
+      : thread_count_{std::max<std::size_t>(thread_count, 1)} {}
+
+  std::size_t thread_count() const { return thread_count_; }
+
+  // run_job(worker, job) is called once per job; worker is in
+  // [0, thread_count()) and identifies the calling thread's scratch space.
+  template <typename CostFunction, typename JobFunction>
+  void run(std::size_t job_count, CostFunction estimate_cost,
+           JobFunction run_job) {
+    if (job_count == 0) {
+      return;
     }
-    std::cout << '\n';
-    clear_input_buffer();
+    std::vector<std::size_t> order(job_count);
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<std::size_t> costs(job_count);
+    for (std::size_t job{0}; job < job_count; job++) {
+      costs[job] = estimate_cost(job);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&costs](std::size_t lhs, std::size_t rhs) {
+                       return costs[lhs] > costs[rhs];
+                     });
 
-    constexpr bool is_new_file{false};
-    std::string file_name;
-    while (true) {
-      file_name = prompt_file_name(cwd_files, is_new_file);
-      if (file_exists(file_name, cwd_files)) {
-        std::cout << "\tLoading messages from filename '" << file_name
-                  << "'...\n";
-        return file_name;
-      }
-      std::cout << "\tFile does not exist.\n";
+    const std::size_t worker_count{std::min(thread_count_, job_count)};
+    const std::size_t block_size{
+        std::clamp<std::size_t>(job_count / (worker_count * 8), 1, 256)};
+    std::vector<WorkQueue> queues(worker_count);
+    std::size_t block_index{0};
+    for (std::size_t begin{0}; begin < job_count; begin += block_size) {
+      queues[block_index++ % worker_count].blocks.push_back(
+          {begin, std::min(begin + block_size, job_count)});
     }
-  }
 
- public:
-  std::vector<std::string> load_from_file() {
-    const std::string file_name{get_existing_file_name()};
-    std::ifstream file(file_name);
-    if (!file.is_open()) {
-      throw CustomException("\tError opening file. Ensure correct file type.");
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto worker_loop{[&](std::size_t worker) {
+      try {
+        JobBlock block;
+        while (take_block(queues, worker, block)) {
+          for (std::size_t index{block.begin}; index < block.end; index++) {
+            run_job(worker, order[index]);
+          }
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }};
+
+    std::vector<std::thread> threads;
+    threads.reserve(worker_count - 1);
+    for (std::size_t worker{1}; worker < worker_count; worker++) {
+      threads.emplace_back(worker_loop, worker);
+    }
+    worker_loop(0);
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    if (error) {
+      std::rethrow_exception(error);
     }
+  }
+};
 
-    std::vector<std::string> messages;
-    std::string message;
-    while (std::getline(file, message)) {
-      messages.push_back(string_to_upper(sanitise_non_utf8(message)));
+// Encodes / decodes whole batches of messages in parallel while keeping
+// results in input order. Each worker owns an EncoderDecoder and therefore
+// its own grid.
+class BatchProcessor {
+ private:
+  // A run of messages decoded together by decode_group; a grid_size of 0
+  // marks a single message left to the per-message path.
+  struct DecodeTile {
+    std::size_t begin;
+    std::size_t count;
+    int grid_size;
+  };
+
+  WorkStealingPool pool_;
+  std::vector<EncoderDecoder> encoder_decoders_;
+  bool is_caching_;
+  bool is_deterministic_padding_;
+
+  // Runs process once per distinct message and copies each result to the
+  // message's repeats.
+  template <typename Process>
+  std::vector<std::string> process_distinct(
+      const std::vector<std::string_view> &messages, Process process) {
+    std::unordered_map<std::string_view, std::size_t> slots;
+    slots.reserve(messages.size());
+    std::vector<std::size_t> slot_of(messages.size());
+    std::vector<std::string_view> distinct_messages;
+    for (std::size_t index{0}; index < messages.size(); index++) {
+      const auto slot{slots.try_emplace(messages[index], slots.size()).first};
+      if (slot->second == distinct_messages.size()) {
+        distinct_messages.push_back(messages[index]);
+      }
+      slot_of[index] = slot->second;
     }
-    file.close();
-    if (messages.empty()) {
-      throw CustomException("\tNo messages found in the file.");
+    if (distinct_messages.size() == messages.size()) {
+      return process(messages);
+    }
+    global_statistics.record_deduplicated(messages.size() -
+                                          distinct_messages.size());
+
+    const std::vector<std::string> distinct_results{process(distinct_messages)};
+    std::vector<std::string> results(messages.size());
+    for (std::size_t index{0}; index < messages.size(); index++) {
+      results[index] = distinct_results[slot_of[index]];
     }
-    return messages;
+    return results;
   }
 
-  void save_to_file(const std::vector<std::string> &messages) {
-    if (messages.empty()) {
-      throw CustomException("\tNo messages to save.");
+  static std::string process_message(EncoderDecoder &encoder_decoder,
+                                     std::string_view message,
+                                     const bool encode_flag, int grid_size,
+                                     int prefix_length) {
+    if (message.empty()) {
+      return {};
     }
+    CodecResult<std::string> result{
+        encode_flag ? encoder_decoder.try_encode(message, grid_size)
+        : prefix_length != 0
+            ? encoder_decoder.try_decode_prefix(message, prefix_length)
+            : encoder_decoder.try_decode(message)};
+    if (result) {
+      return std::move(result).value();
+    }
+    // Add line for failures - we use 'FE:: / FD::' as it is ambiguous
+    // to users unfamiliar with the encryption
+    global_statistics.record_failure(encode_flag ? Stage::encode
+                                                 : Stage::decode);
+    std::string failure{encode_flag ? "FE::" : "FD::"};
+    failure += message;
+    return failure;
+  }
 
-    const std::string file_name{get_new_file_name()};
-    std::ofstream file(file_name);
+  std::vector<std::string> process_all(
+      const std::vector<std::string_view> &messages, const bool encode_flag,
+      int grid_size, int prefix_length) {
+    std::vector<std::string> results(messages.size());
+    pool_.run(
+        messages.size(),
+        [&messages](std::size_t job) { return messages[job].length(); },
+        [&](std::size_t worker, std::size_t job) {
+          results[job] =
+              process_message(encoder_decoders_[worker], messages[job],
+                              encode_flag, grid_size, prefix_length);
+        });
+    return results;
+  }
+
+  // Grid size of an encoded message that exactly fills an odd grid the
+  // specialised kernels cover, or 0.
+  static int group_grid_size(std::size_t encoded_length) {
+    const int grid_size{static_cast<int>(integer_sqrt(encoded_length))};
+    return has_codec_kernels(grid_size) &&
+                   static_cast<std::size_t>(square(grid_size)) == encoded_length
+               ? grid_size
+               : 0;
+  }
+
+  // Groups messages by grid size so full grids are decoded decode_group_size
+  // at a time; anything else takes the per-message path.
+  std::vector<std::string> decode_grouped(
+      const std::vector<std::string_view> &messages) {
+    std::vector<std::vector<std::size_t>> groups(global_max_size + 1);
+    std::vector<std::size_t> singles;
+    for (std::size_t index{0}; index < messages.size(); index++) {
+      const int grid_size{group_grid_size(messages[index].length())};
+      grid_size != 0 ? groups[grid_size].push_back(index)
+                     : singles.push_back(index);
+    }
+
+    std::vector<std::size_t> order;
+    std::vector<DecodeTile> tiles;
+    order.reserve(messages.size());
+    for (int grid_size{3}; grid_size <= global_max_size; grid_size += 2) {
+      const std::vector<std::size_t> &group{groups[grid_size]};
+      for (std::size_t begin{0}; begin < group.size();
+           begin += decode_group_size) {
+        tiles.push_back({order.size() + begin,
+                         std::min(decode_group_size, group.size() - begin),
+                         grid_size});
+      }
+      order.insert(order.end(), group.begin(), group.end());
+    }
+    for (std::size_t index : singles) {
+      tiles.push_back({order.size(), 1, 0});
+      order.push_back(index);
+    }
+
+    std::vector<std::string> results(messages.size());
+    constexpr bool encode_flag{false};
+    pool_.run(
+        tiles.size(),
+        [&](std::size_t job) {
+          const DecodeTile &tile{tiles[job]};
+          return tile.grid_size != 0
+                     ? tile.count * square(tile.grid_size)
+                     : messages[order[tile.begin]].length();
+        },
+        [&](std::size_t worker, std::size_t job) {
+          const DecodeTile &tile{tiles[job]};
+          if (tile.grid_size == 0) {
+            const std::size_t index{order[tile.begin]};
+            results[index] =
+                process_message(encoder_decoders_[worker], messages[index],
+                                encode_flag, 0, 0);
+            return;
+          }
+          StageTimer timer{Stage::decode, tile.count * square(tile.grid_size),
+                           tile.count};
+          const char *encoded_messages[decode_group_size];
+          char *outputs[decode_group_size];
+          for (std::size_t lane{0}; lane < tile.count; lane++) {
+            const std::size_t index{order[tile.begin + lane]};
+            encoded_messages[lane] = messages[index].data();
+            results[index].resize(decoded_length(tile.grid_size));
+            outputs[lane] = &results[index][0];
+          }
+          DiamondCodec::decode_group(tile.grid_size, encoded_messages, outputs,
+                                     tile.count);
+        });
+    return results;
+  }
+
+ public:
+  BatchProcessor(std::size_t thread_count = std::thread::hardware_concurrency())
+      : pool_{thread_count},
+        encoder_decoders_(pool_.thread_count()),
+        is_caching_{false},
+        is_deterministic_padding_{false} {}
+
+  void set_padding_source(std::shared_ptr<PaddingSource> padding_source) {
+    is_deterministic_padding_ = padding_source->is_deterministic();
+    for (auto &encoder_decoder : encoder_decoders_) {
+      encoder_decoder.set_padding_source(padding_source);
+    }
+  }
+
+  // Gives every worker an LRU cache of `entries` results and removes
+  // repeated lines from each batch before it is encoded; 0 turns both off.
+  // Both only apply when padding is deterministic.
+  void set_result_cache_size(std::size_t entries) {
+    is_caching_ = entries != 0;
+    for (auto &encoder_decoder : encoder_decoders_) {
+      encoder_decoder.set_result_cache(
+          entries != 0 ? std::make_shared<ResultCache>(entries) : nullptr);
+    }
+  }
+
+  // A grid_size of 0 encodes each message into its smallest grid.
+  std::vector<std::string> encode_all(
+      const std::vector<std::string_view> &messages, int grid_size = 0) {
+    constexpr bool encode_flag{true};
+    auto encode_messages{[&](const std::vector<std::string_view> &batch) {
+      return process_all(batch, encode_flag, grid_size, 0);
+    }};
+    return is_caching_ && is_deterministic_padding_
+               ? process_distinct(messages, encode_messages)
+               : encode_messages(messages);
+  }
+
+  // A non-zero prefix_length decodes only that many leading characters.
+  // Decodes skip deduplication and the result cache: decoding a message is
+  // cheaper than hashing it.
+  std::vector<std::string> decode_all(
+      const std::vector<std::string_view> &messages, int prefix_length = 0) {
+    if (prefix_length == 0) {
+      return decode_grouped(messages);
+    }
+    constexpr bool encode_flag{false};
+    return process_all(messages, encode_flag, 0, prefix_length);
+  }
+};
+
+// Fixed-capacity queue between pipeline stages. Closing it wakes every
+// waiting thread: pop still drains what is queued, push is refused.
+template <typename T>
+class BoundedQueue {
+ private:
+  std::size_t capacity_;
+  std::deque<T> items_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  bool is_closed_;
+
+ public:
+  BoundedQueue(std::size_t capacity) : capacity_{capacity}, is_closed_{false} {}
+
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] {
+      return is_closed_ || items_.size() < capacity_;
+    });
+    if (is_closed_) {
+      return false;
+    }
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return is_closed_ || !items_.empty(); });
+    if (items_.empty()) {
+      return false;
+    }
+    item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+};
+
+// Bounded lock-free multi-producer / multi-consumer ring. Each cell carries a
+// sequence number that tells producers and consumers whether it is free or
+// filled for their turn, so a push or pop is one compare-and-swap on the
+// shared position plus a release store to the cell. Capacity must be a
+// power of two.
+template <typename T>
+class MpmcQueue {
+ private:
+  struct alignas(64) Cell {
+    std::atomic<std::size_t> sequence;
+    T item;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  std::size_t mask_;
+  alignas(64) std::atomic<std::size_t> push_position_;
+  alignas(64) std::atomic<std::size_t> pop_position_;
+
+ public:
+  MpmcQueue(std::size_t capacity)
+      : cells_{std::make_unique<Cell[]>(capacity)},
+        mask_{capacity - 1},
+        push_position_{0},
+        pop_position_{0} {
+    if (capacity < 2 || (capacity & mask_) != 0) {
+      throw CustomException("\tQueue capacity must be a power of two.");
+    }
+    for (std::size_t index{0}; index < capacity; index++) {
+      cells_[index].sequence.store(index, std::memory_order_relaxed);
+    }
+  }
+
+  // Moves from item only when there was room.
+  bool try_push(T &item) {
+    std::size_t position{push_position_.load(std::memory_order_relaxed)};
+    while (true) {
+      Cell &cell{cells_[position & mask_]};
+      const std::size_t sequence{cell.sequence.load(std::memory_order_acquire)};
+      const std::ptrdiff_t difference{static_cast<std::ptrdiff_t>(sequence) -
+                                      static_cast<std::ptrdiff_t>(position)};
+      if (difference == 0) {
+        if (push_position_.compare_exchange_weak(position, position + 1,
+                                                 std::memory_order_relaxed)) {
+          cell.item = std::move(item);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = push_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool try_pop(T &item) {
+    std::size_t position{pop_position_.load(std::memory_order_relaxed)};
+    while (true) {
+      Cell &cell{cells_[position & mask_]};
+      const std::size_t sequence{cell.sequence.load(std::memory_order_acquire)};
+      const std::ptrdiff_t difference{static_cast<std::ptrdiff_t>(sequence) -
+                                      static_cast<std::ptrdiff_t>(position + 1)};
+      if (difference == 0) {
+        if (pop_position_.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+          item = std::move(cell.item);
+          cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = pop_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+// Serialises results into the blocks a LinePipeline writes. begin and finish
+// run on the calling thread around the whole run, for formats that need a
+// header or trailer.
+class OutputFormat {
+ public:
+  virtual ~OutputFormat() = default;
+  virtual void begin(std::ostream &) {}
+  virtual void append(std::string_view result, std::string &block) = 0;
+  virtual void finish(std::ostream &) {}
+};
+
+// One result per line, with failures marked 'FE::' / 'FD::'.
+class TextFormat : public OutputFormat {
+ public:
+  void append(std::string_view result, std::string &block) override {
+    block += result;
+    block += '\n';
+  }
+};
+
+// Reads, encodes / decodes and writes line-based input as three overlapped
+// stages. The reader and writer run on their own threads and move data in
+// large blocks while the codec stage works on the block in between. Each
+// side cycles through a fixed pair of buffers, so memory use does not grow
+// with the input.
+class LinePipeline {
+ private:
+  struct InputBlock {
+    std::vector<char> data;
+    std::vector<std::string_view> messages;
+  };
+
+  static constexpr std::size_t block_size_{1 << 20};
+  static constexpr std::size_t buffer_count_{2};
+
+  std::shared_ptr<BatchProcessor> batch_processor_;
+  std::shared_ptr<OutputFormat> output_format_;
+  BoundedQueue<InputBlock> free_inputs_;
+  BoundedQueue<InputBlock> filled_inputs_;
+  BoundedQueue<std::string> free_outputs_;
+  BoundedQueue<std::string> filled_outputs_;
+
+  void close_queues() {
+    free_inputs_.close();
+    filled_inputs_.close();
+    free_outputs_.close();
+    filled_outputs_.close();
+  }
+
+  // Splits the complete lines of a block into normalised messages. As with
+  // std::getline, a final line without a newline only counts if non-empty.
+  static void index_lines(InputBlock &block, std::size_t size) {
+    StageTimer timer{Stage::normalise, size};
+    char *data{block.data.data()};
+    std::size_t begin{0};
+    while (begin < size) {
+      const char *newline{
+          static_cast<const char *>(std::memchr(data + begin, '\n', size - begin))};
+      const std::size_t end{newline != nullptr
+                                ? static_cast<std::size_t>(newline - data)
+                                : size};
+      block.messages.emplace_back(
+          data + begin, normalise_in_place(data + begin, end - begin));
+      begin = end + 1;
+    }
+    timer.set_events(block.messages.size());
+  }
+
+  void read_blocks(std::istream &input) {
+    std::string carry;
+    bool is_end_of_input{false};
+    InputBlock block;
+    while (!is_end_of_input && free_inputs_.pop(block)) {
+      std::size_t size{carry.length()};
+      if (block.data.size() < size + block_size_) {
+        block.data.resize(size + block_size_);
+      }
+      std::copy(carry.begin(), carry.end(), block.data.begin());
+
+      // Keep reading until the block ends in at least one complete line; a
+      // line longer than the block grows it.
+      std::size_t line_end{0};
+      while (true) {
+        StageTimer timer{Stage::load};
+        input.read(block.data.data() + size, block.data.size() - size);
+        const std::size_t read_size{static_cast<std::size_t>(input.gcount())};
+        timer.set_bytes(read_size);
+        is_end_of_input = !input;
+        for (std::size_t index{size + read_size}; index > size; index--) {
+          if (block.data[index - 1] == '\n') {
+            line_end = index;
+            break;
+          }
+        }
+        size += read_size;
+        if (line_end != 0 || is_end_of_input) {
+          break;
+        }
+        block.data.resize(block.data.size() * 2);
+      }
+      if (input.bad()) {
+        throw CustomException("\tError reading input.");
+      }
+      if (is_end_of_input) {
+        line_end = size;
+      }
+
+      carry.assign(block.data.data() + line_end, size - line_end);
+      block.messages.clear();
+      index_lines(block, line_end);
+      if (!filled_inputs_.push(std::move(block))) {
+        return;
+      }
+    }
+    filled_inputs_.close();
+  }
+
+  void write_blocks(std::ostream &output) {
+    std::string block;
+    while (filled_outputs_.pop(block)) {
+      {
+        StageTimer timer{Stage::save, block.length()};
+        output.write(block.data(), block.length());
+      }
+      if (!output) {
+        throw CustomException("\tError writing output.");
+      }
+      if (!free_outputs_.push(std::move(block))) {
+        return;
+      }
+    }
+  }
+
+  std::uintmax_t process_blocks(const bool encode_flag, int grid_size,
+                                int prefix_length) {
+    std::uintmax_t message_count{0};
+    InputBlock input_block;
+    std::string output_block;
+    while (filled_inputs_.pop(input_block)) {
+      const std::vector<std::string> results{
+          encode_flag
+              ? batch_processor_->encode_all(input_block.messages, grid_size)
+              : batch_processor_->decode_all(input_block.messages,
+                                             prefix_length)};
+      if (!free_outputs_.pop(output_block)) {
+        break;
+      }
+      output_block.clear();
+      for (const auto &result : results) {
+        output_format_->append(result, output_block);
+      }
+      message_count += results.size();
+      if (!filled_outputs_.push(std::move(output_block)) ||
+          !free_inputs_.push(std::move(input_block))) {
+        break;
+      }
+    }
+    filled_outputs_.close();
+    return message_count;
+  }
+
+ public:
+  LinePipeline(std::shared_ptr<BatchProcessor> batch_processor,
+               std::shared_ptr<OutputFormat> output_format =
+                   std::make_shared<TextFormat>())
+      : batch_processor_{std::move(batch_processor)},
+        output_format_{std::move(output_format)},
+        free_inputs_{buffer_count_},
+        filled_inputs_{buffer_count_},
+        free_outputs_{buffer_count_},
+        filled_outputs_{buffer_count_} {
+    for (std::size_t index{0}; index < buffer_count_; index++) {
+      free_inputs_.push(InputBlock{});
+      free_outputs_.push(std::string{});
+    }
+  }
+
+  // Runs the whole input through the pipeline, returning the number of
+  // messages written. The first error raised by any stage is rethrown once
+  // every stage has stopped.
+  std::uintmax_t run(std::istream &input, std::ostream &output,
+                     const bool encode_flag, int grid_size = 0,
+                     int prefix_length = 0) {
+    std::exception_ptr read_error;
+    std::exception_ptr write_error;
+    std::exception_ptr process_error;
+    output_format_->begin(output);
+    auto run_stage{[this](std::exception_ptr &error, auto stage) {
+      try {
+        stage();
+      } catch (...) {
+        error = std::current_exception();
+        close_queues();
+      }
+    }};
+
+    std::thread reader{run_stage, std::ref(read_error),
+                       [this, &input] { read_blocks(input); }};
+    std::thread writer{run_stage, std::ref(write_error),
+                       [this, &output] { write_blocks(output); }};
+    std::uintmax_t message_count{0};
+    run_stage(process_error, [&] {
+      message_count = process_blocks(encode_flag, grid_size, prefix_length);
+    });
+    reader.join();
+    writer.join();
+
+    for (const auto &error : {read_error, process_error, write_error}) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+    output_format_->finish(output);
+    return message_count;
+  }
+};
+
+// A whole file in memory. On POSIX systems the file is mapped copy-on-write,
+// so pages are only duplicated when normalisation modifies them; elsewhere it
+// is read into a single buffer. Random access mappings skip the kernel's
+// read-ahead.
+class MappedFile {
+ private:
+  char *data_;
+  std::size_t size_;
+  bool is_mapped_;
+  std::unique_ptr<char[]> buffer_;
+
+ public:
+  MappedFile(const std::string &file_name, bool is_random_access = false)
+      : data_{nullptr}, size_{0}, is_mapped_{false}, buffer_{nullptr} {
+    StageTimer timer{Stage::load};
+#if defined(__unix__) || defined(__APPLE__)
+    const int file_descriptor{::open(file_name.c_str(), O_RDONLY)};
+    if (file_descriptor < 0) {
+      throw CustomException("\tError opening file. Ensure correct file type.");
+    }
+    struct stat file_status;
+    if (::fstat(file_descriptor, &file_status) != 0) {
+      ::close(file_descriptor);
+      throw CustomException("\tError reading file.");
+    }
+    size_ = static_cast<std::size_t>(file_status.st_size);
+    if (size_ > 0) {
+      void *mapping{::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                           file_descriptor, 0)};
+      if (mapping == MAP_FAILED) {
+        ::close(file_descriptor);
+        throw CustomException("\tError mapping file into memory.");
+      }
+      ::madvise(mapping, size_,
+                is_random_access ? MADV_RANDOM : MADV_SEQUENTIAL);
+      data_ = static_cast<char *>(mapping);
+      is_mapped_ = true;
+    }
+    ::close(file_descriptor);
+#else
+    std::ifstream file(file_name, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
-      throw CustomException("\tError opening file.");
+      throw CustomException("\tError opening file. Ensure correct file type.");
     }
+    size_ = static_cast<std::size_t>(file.tellg());
+    buffer_ = std::make_unique<char[]>(size_ + 1);
+    file.seekg(0);
+    if (!file.read(buffer_.get(), size_)) {
+      throw CustomException("\tError reading file.");
+    }
+    data_ = buffer_.get();
+#endif
+    timer.set_bytes(size_);
+  }
 
-    for (auto &message : messages) {
-      file << message << '\n';
+  ~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (is_mapped_) {
+      ::munmap(data_, size_);
     }
-    std::cout << "\tMessages saved to file '" << file_name << "'" << std::endl;
-    file.close();
+#endif
   }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  char *data() { return data_; }
+  std::size_t size() const { return size_; }
 };
 
-enum class MessageType { raw, encoded, decoded };
+// Messages of a file as views over its mapping, one per line, normalised in
+// place as the lines are indexed.
+class MessageFile {
+ private:
+  MappedFile mapped_file_;
+  std::vector<std::string_view> messages_;
 
-class MessageBuffer {
+ public:
+  MessageFile(const std::string &file_name) : mapped_file_{file_name} {
+    char *data{mapped_file_.data()};
+    const std::size_t size{mapped_file_.size()};
+    StageTimer timer{Stage::normalise, size};
+    std::size_t line_start{0};
+    while (line_start < size) {
+      const char *line_end{static_cast<const char *>(
+          std::memchr(data + line_start, '\n', size - line_start))};
+      const std::size_t line_length{
+          line_end ? static_cast<std::size_t>(line_end - (data + line_start))
+                   : size - line_start};
+      messages_.emplace_back(data + line_start,
+                             normalise_in_place(data + line_start, line_length));
+      line_start += line_length + 1;
+    }
+    timer.set_events(messages_.size());
+  }
+
+  const std::vector<std::string_view> &messages() const { return messages_; }
+};
+
+// Unsigned integers stored in byte_count little-endian bytes, as used by the
+// archive and socket formats.
+void put_little_endian(char *destination, std::uint64_t value,
+                       int byte_count) {
+  for (int index{0}; index < byte_count; index++) {
+    destination[index] = static_cast<char>((value >> (8 * index)) & 0xFF);
+  }
+}
+
+std::uint64_t get_little_endian(const char *source, int byte_count) {
+  std::uint64_t value{0};
+  for (int index{0}; index < byte_count; index++) {
+    value |=
+        static_cast<std::uint64_t>(static_cast<unsigned char>(source[index]))
+        << (8 * index);
+  }
+  return value;
+}
+
+// Status of an archived record. Failed records keep the message that could
+// not be encoded / decoded, as the 'FE::' / 'FD::' lines of the text format
+// do.
+enum class RecordStatus : std::uint8_t { ok, encode_failed, decode_failed };
+
+struct ArchiveRecord {
+  std::string_view payload;
+  int grid_size;
+  RecordStatus status;
+  bool is_packed;
+};
+
+// Binary archive layout, all integers little-endian:
+//   header   "DMA1", u32 reserved, u64 record count, u64 index offset,
+//            u64 reserved
+//   records  payloads back to back
+//   index    per record: u64 offset, u32 length, u16 grid size, u8 status,
+//            u8 flags
+// The index follows the records so an archive is written in a single pass,
+// with the header patched once the counts are known. A record flagged as
+// packed holds its grid at five bits a cell (see packed_size) and its length
+// is the packed length.
+class ArchiveLayout {
+ public:
+  static constexpr char magic[4]{'D', 'M', 'A', '1'};
+  static constexpr std::size_t header_size{32};
+  static constexpr std::size_t entry_size{16};
+  static constexpr std::uint8_t packed_flag{0x01};
+
+  static constexpr std::string_view status_prefix(RecordStatus status) {
+    return status == RecordStatus::encode_failed   ? "FE::"
+           : status == RecordStatus::decode_failed ? "FD::"
+                                                   : "";
+  }
+
+  // A line of the text format as a record. Encoded grids always start with
+  // padding letters, so a failure prefix is never mistaken for a grid.
+  static ArchiveRecord parse_line(std::string_view line) {
+    RecordStatus status{RecordStatus::ok};
+    for (const RecordStatus failure :
+         {RecordStatus::encode_failed, RecordStatus::decode_failed}) {
+      if (line.substr(0, 4) == status_prefix(failure)) {
+        status = failure;
+        line.remove_prefix(4);
+        break;
+      }
+    }
+    const std::size_t grid_size{
+        static_cast<std::size_t>(integer_sqrt(line.length()))};
+    const bool is_grid{status == RecordStatus::ok && grid_size % 2 != 0 &&
+                       grid_size <= UINT16_MAX &&
+                       grid_size * grid_size == line.length()};
+    return {line, is_grid ? static_cast<int>(grid_size) : 0, status, false};
+  }
+};
+
+// Writes results as a binary archive. The index is kept in memory until
+// finish, at 16 bytes a record, and the output must be seekable. When
+// packing, encoded grids of letters only are stored packed.
+class ArchiveWriter : public OutputFormat {
+ private:
+  bool is_packing_;
+  std::vector<char> index_;
+  std::uint64_t record_count_;
+  std::uint64_t offset_;
+
+  void write_header(std::ostream &output) {
+    char header[ArchiveLayout::header_size]{};
+    std::copy(std::begin(ArchiveLayout::magic), std::end(ArchiveLayout::magic),
+              header);
+    put_little_endian(header + 8, record_count_, 8);
+    put_little_endian(header + 16, offset_, 8);
+    output.write(header, ArchiveLayout::header_size);
+  }
+
+ public:
+  ArchiveWriter(bool is_packing = false)
+      : is_packing_{is_packing},
+        record_count_{0},
+        offset_{ArchiveLayout::header_size} {}
+
+  void begin(std::ostream &output) override {
+    index_.clear();
+    record_count_ = 0;
+    offset_ = ArchiveLayout::header_size;
+    write_header(output);
+  }
+
+  void append(std::string_view result, std::string &block) override {
+    const ArchiveRecord record{ArchiveLayout::parse_line(result)};
+    if (record.payload.length() > UINT32_MAX) {
+      throw CustomException("\tRecord is too long for an archive.");
+    }
+    const bool is_packed{is_packing_ && record.grid_size != 0 &&
+                         is_packable(record.payload)};
+    const std::size_t length{is_packed ? packed_size(record.payload.length())
+                                       : record.payload.length()};
+    char entry[ArchiveLayout::entry_size]{};
+    put_little_endian(entry, offset_, 8);
+    put_little_endian(entry + 8, length, 4);
+    put_little_endian(entry + 12, record.grid_size, 2);
+    put_little_endian(entry + 14, static_cast<std::uint8_t>(record.status), 1);
+    put_little_endian(entry + 15, is_packed ? ArchiveLayout::packed_flag : 0,
+                      1);
+    index_.insert(index_.end(), std::begin(entry), std::end(entry));
+    if (is_packed) {
+      const std::size_t block_length{block.length()};
+      block.resize(block_length + length);
+      pack_letters(record.payload, &block[block_length]);
+    } else {
+      block += record.payload;
+    }
+    offset_ += length;
+    record_count_++;
+  }
+
+  void finish(std::ostream &output) override {
+    StageTimer timer{Stage::save, index_.size() + ArchiveLayout::header_size};
+    output.write(index_.data(), index_.size());
+    output.seekp(0);
+    write_header(output);
+    output.seekp(0, std::ios::end);
+    if (!output) {
+      throw CustomException("\tError writing archive. Output must be a file.");
+    }
+  }
+};
+
+// Records of an archive as views over its mapping. Any record is found in
+// constant time from its index entry, without touching the others.
+class ArchiveReader {
  private:
-  std::string raw_message_;
-  std::string encoded_message_;
-  std::string decoded_message_;
+  MappedFile mapped_file_;
+  std::uint64_t record_count_;
+  std::uint64_t index_offset_;
 
  public:
-  MessageBuffer() {}
+  ArchiveReader(const std::string &file_name)
+      : mapped_file_{file_name, true}, record_count_{0}, index_offset_{0} {
+    const char *data{mapped_file_.data()};
+    const std::uint64_t size{mapped_file_.size()};
+    if (size < ArchiveLayout::header_size ||
+        !std::equal(std::begin(ArchiveLayout::magic),
+                    std::end(ArchiveLayout::magic), data)) {
+      throw CustomException("\tFile is not a message archive.");
+    }
+    record_count_ = get_little_endian(data + 8, 8);
+    index_offset_ = get_little_endian(data + 16, 8);
+    if (index_offset_ < ArchiveLayout::header_size || index_offset_ > size ||
+        record_count_ != (size - index_offset_) / ArchiveLayout::entry_size ||
+        (size - index_offset_) % ArchiveLayout::entry_size != 0) {
+      throw CustomException("\tArchive index is damaged.");
+    }
+  }
+
+  std::uint64_t record_count() const { return record_count_; }
+
+  ArchiveRecord record(std::uint64_t index) {
+    if (index >= record_count_) {
+      throw CustomException("\tRecord number is out of range.");
+    }
+    const char *entry{mapped_file_.data() + index_offset_ +
+                      index * ArchiveLayout::entry_size};
+    const std::uint64_t offset{get_little_endian(entry, 8)};
+    const std::uint64_t length{get_little_endian(entry + 8, 4)};
+    const int grid_size{static_cast<int>(get_little_endian(entry + 12, 2))};
+    const std::uint64_t status{get_little_endian(entry + 14, 1)};
+    const std::uint64_t flags{get_little_endian(entry + 15, 1)};
+    const bool is_packed{(flags & ArchiveLayout::packed_flag) != 0};
+    if (offset < ArchiveLayout::header_size || offset > index_offset_ ||
+        length > index_offset_ - offset ||
+        status > static_cast<std::uint64_t>(RecordStatus::decode_failed) ||
+        (flags & ~std::uint64_t{ArchiveLayout::packed_flag}) != 0 ||
+        (is_packed &&
+         (status != static_cast<std::uint64_t>(RecordStatus::ok) ||
+          length != packed_size(static_cast<std::size_t>(grid_size) *
+                                grid_size)))) {
+      throw CustomException("\tArchive record is damaged.");
+    }
+    return {std::string_view{mapped_file_.data() + offset,
+                             static_cast<std::size_t>(length)},
+            grid_size, static_cast<RecordStatus>(status), is_packed};
+  }
+};
+
+class FileOperations {
+ private:
+  inline static std::string executable_name_;
+  inline static std::size_t shard_size_{0};
+  inline static std::size_t next_default_index_{0};
+
+  static constexpr std::size_t listing_limit_{50};
+  static constexpr std::size_t default_search_limit_{100};
+
+  static bool file_exists(const std::string &file_name) {
+    std::error_code error;
+    return std::filesystem::exists(file_name, error);
+  }
+
+  // default_NN.txt, inside shard_NNNN/ directories of shard_size_ files
+  // each when sharding is enabled.
+  static std::string default_file_name(std::size_t index) {
+    std::stringstream ss;
+    if (shard_size_ != 0) {
+      ss << "shard_" << std::setw(4) << std::setfill('0')
+         << index / shard_size_ << '/';
+    }
+    ss << "default_" << std::setw(2) << std::setfill('0') << index << ".txt";
+    return ss.str();
+  }
+
+  // First unused default index from begin on. Default names are taken in
+  // order, so a galloping search followed by a binary search finds it with
+  // O(log n) existence checks, and only once per run.
+  static std::size_t find_free_default_index(std::size_t begin) {
+    if (!file_exists(default_file_name(begin))) {
+      return begin;
+    }
+    std::size_t used{begin};
+    std::size_t step{1};
+    while (file_exists(default_file_name(begin + step))) {
+      used = begin + step;
+      step *= 2;
+    }
+    std::size_t unused{begin + step};
+    while (unused - used > 1) {
+      const std::size_t middle{used + (unused - used) / 2};
+      file_exists(default_file_name(middle)) ? used = middle : unused = middle;
+    }
+    return unused;
+  }
+
+  // Claims the next default name by creating it exclusively, so two runs
+  // saving into the same directory never receive the same file.
+  static std::string allocate_default_file_name() {
+    while (true) {
+      next_default_index_ = find_free_default_index(next_default_index_);
+      const std::string file_name{default_file_name(next_default_index_++)};
+      if (shard_size_ != 0) {
+        std::error_code error;
+        std::filesystem::create_directories(
+            std::filesystem::path(file_name).parent_path(), error);
+      }
+      std::FILE *file{std::fopen(file_name.c_str(), "wx")};
+      if (file != nullptr) {
+        std::fclose(file);
+        return file_name;
+      }
+      if (errno != EEXIST) {
+        throw CustomException("\tError creating default file.");
+      }
+    }
+  }
+
+  static std::string find_default_file_name() {
+    for (std::size_t index{0}; index < default_search_limit_; index++) {
+      if (file_exists(default_file_name(index))) {
+        return default_file_name(index);
+      }
+    }
+    return default_file_name(0);
+  }
+
+  // Returns the entered filename, or an empty string for the default.
+  std::string prompt_file_name() {
+    std::string file_name;
+    std::cout
+        << "Enter the filename (leave empty for default, 'menu' to return): ";
+    std::getline(std::cin, file_name);
+    if (string_to_upper(file_name) == "MENU") {
+      throw CustomException("\tReturning to main menu...");
+    }
+    return file_name;
+  }
+
+  std::string get_new_file_name(const bool clear_buffer = true) {
+    if (clear_buffer) {
+      clear_input_buffer();
+    }
+    while (true) {
+      const std::string file_name{prompt_file_name()};
+      if (file_name.empty()) {
+        std::cout << "\tAllocating a default filename..." << '\n';
+        return allocate_default_file_name();
+      }
+      if (!file_exists(file_name)) {
+        return file_name;
+      }
+      if (get_user_choice(
+              "File already exists. Do you want to overwrite? (y/n): ") ==
+          'Y') {
+        return file_name;
+      }
+      std::cout << "Enter a new filename.\n";
+      clear_input_buffer();
+    }
+  }
+
+  // Lists at most listing_limit_ entries, so large directories are never
+  // walked in full.
+  void list_directory() {
+    std::cout << "Contents of current directory:\n";
+    const std::string program_name{
+        std::filesystem::path(__FILE__).filename().string()};
+    std::size_t listed_count{0};
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(".", error)) {
+      const std::string file{entry.path().filename().string()};
+      if (file == program_name || file == executable_name_) {
+        continue;
+      }
+      if (listed_count++ == listing_limit_) {
+        std::cout << "...\n";
+        break;
+      }
+      std::cout << file << '\n';
+    }
+    std::cout << '\n';
+  }
+
+  std::string get_existing_file_name() {
+    list_directory();
+    clear_input_buffer();
+
+    while (true) {
+      std::string file_name{prompt_file_name()};
+      if (file_name.empty()) {
+        std::cout << "\tSearching for default filenames..." << '\n';
+        file_name = find_default_file_name();
+      }
+      if (file_exists(file_name)) {
+        std::cout << "\tLoading messages from filename '" << file_name
+                  << "'...\n";
+        return file_name;
+      }
+      std::cout << "\tFile does not exist.\n";
+    }
+  }
+
+ public:
+  // Spreads default files over subdirectories of shard_size files each;
+  // 0 keeps them all in the working directory.
+  static void set_shard_size(std::size_t shard_size) {
+    shard_size_ = shard_size;
+  }
+
+  static void set_executable_name(const std::string &executable_path) {
+    executable_name_ = std::filesystem::path(executable_path).filename().string();
+  }
+
+  std::ifstream open_stream_input() {
+    const std::string file_name{get_existing_file_name()};
+    std::ifstream file(file_name, std::ios::binary);
+    if (!file.is_open()) {
+      throw CustomException("\tError opening file.");
+    }
+    return file;
+  }
+
+  std::ofstream open_stream_output() {
+    std::cout << "Output file for the streamed messages.\n";
+    constexpr bool clear_buffer{false};
+    const std::string file_name{get_new_file_name(clear_buffer)};
+    std::ofstream file(file_name, std::ios::binary);
+    if (!file.is_open()) {
+      throw CustomException("\tError opening file.");
+    }
+    std::cout << "\tStreaming messages to file '" << file_name << "'...\n";
+    return file;
+  }
+
+  std::unique_ptr<MessageFile> load_from_file() {
+    std::unique_ptr<MessageFile> message_file{
+        std::make_unique<MessageFile>(get_existing_file_name())};
+    if (message_file->messages().empty()) {
+      throw CustomException("\tNo messages found in the file.");
+    }
+    return message_file;
+  }
+
+  void save_to_file(const std::vector<std::string> &messages) {
+    if (messages.empty()) {
+      throw CustomException("\tNo messages to save.");
+    }
+
+    const std::string file_name{get_new_file_name()};
+    std::ofstream file(file_name);
+    if (!file.is_open()) {
+      throw CustomException("\tError opening file.");
+    }
+
+    {
+      StageTimer timer{Stage::save};
+      std::uint64_t byte_count{0};
+      for (auto &message : messages) {
+        file << message << '\n';
+        byte_count += message.length() + 1;
+      }
+      file.flush();
+      timer.set_bytes(byte_count);
+    }
+    std::cout << "\tMessages saved to file '" << file_name << "'" << std::endl;
+    file.close();
+  }
+};
+
+enum class MessageType { raw, encoded, decoded };
+
+// Ring of the last history_size_ raw / encoded / decoded message triples,
+// held in one arena allocated up front. Each record owns three fixed slots.
+// Storing a message makes one copy of it into its slot in the arena and
+// never allocates. Promoting the raw message to the encoded or decoded role
+// only relabels a slot, and readers get views, so neither allocates or
+// copies.
+class MessageBuffer {
+ private:
+  static constexpr std::size_t slot_size_{999};
+  static constexpr std::size_t history_size_{8};
+  static constexpr int slots_per_record_{3};
+
+  struct MessageRecord {
+    int slot_of[slots_per_record_];
+    std::size_t lengths[slots_per_record_];
+  };
+
+  std::unique_ptr<char[]> arena_;
+  MessageRecord records_[history_size_];
+  std::size_t current_;
+
+  char *slot_data(std::size_t record, int slot) const {
+    return arena_.get() + (record * slots_per_record_ + slot) * slot_size_;
+  }
+
+  static int type_index(MessageType message_type) {
+    return static_cast<int>(message_type);
+  }
+
+  void reset_record(std::size_t record) {
+    for (int slot{0}; slot < slots_per_record_; slot++) {
+      records_[record].slot_of[slot] = slot;
+      records_[record].lengths[slot] = 0;
+    }
+  }
+
+  void store(std::string_view message, MessageType message_type) {
+    MessageRecord &record{records_[current_]};
+    const int slot{record.slot_of[type_index(message_type)]};
+    // memmove, as the message may be a view of another slot
+    std::memmove(slot_data(current_, slot), message.data(), message.length());
+    record.lengths[slot] = message.length();
+  }
+
+  // Hands the raw message's slot to `message_type`; the slot it held before
+  // becomes the now empty raw slot.
+  void promote_raw(MessageType message_type) {
+    MessageRecord &record{records_[current_]};
+    std::swap(record.slot_of[type_index(MessageType::raw)],
+              record.slot_of[type_index(message_type)]);
+    record.lengths[record.slot_of[type_index(MessageType::raw)]] = 0;
+  }
+
+ public:
+  MessageBuffer()
+      : arena_{std::make_unique<char[]>(history_size_ * slots_per_record_ *
+                                        slot_size_)},
+        current_{0} {
+    for (std::size_t record{0}; record < history_size_; record++) {
+      reset_record(record);
+    }
+  }
+
+  static constexpr std::size_t history_size() { return history_size_; }
+
+  void set_message(std::string_view message, const MessageType message_type) {
+    if (message.empty()) {
+      throw CustomException("\tNo message entered.\n");
+    }
+    if (message.length() > slot_size_) {
+      throw CustomException("\tMessage length must be <1000.\n");
+    }
+
+    switch (message_type) {
+      case MessageType::raw: {
+        // A new raw message starts the next record, keeping the current
+        // triple in the history.
+        current_ = (current_ + 1) % history_size_;
+        reset_record(current_);
+        store(message, MessageType::raw);
+        std::cout << "\tMessage buffers cleared..." << '\n';
+        std::cout << "\tStored message: " << get_message(MessageType::raw)
+                  << std::endl;
+        break;
+      }
+      case MessageType::encoded: {
+        if (!get_message(MessageType::raw).empty()) {
+          promote_raw(MessageType::decoded);
+        }
+        store(message, MessageType::encoded);
+        std::cout << "\tStored encoded message: "
+                  << get_message(MessageType::encoded) << std::endl;
+        break;
+      }
+      case MessageType::decoded: {
+        if (!get_message(MessageType::raw).empty()) {
+          promote_raw(MessageType::encoded);
+        }
+        store(message, MessageType::decoded);
+        std::cout << "\tStored decoded message: "
+                  << get_message(MessageType::decoded) << std::endl;
+        break;
+      }
+      default: {
+        throw CustomException("\tInvalid message type.\n");
+      }
+    }
+  }
+
+  // A view of the message in the current record, or in an earlier one when
+  // age is non-zero. The view is valid until that slot is next written.
+  std::string_view get_message(MessageType message_type,
+                               std::size_t age = 0) const {
+    if (age >= history_size_) {
+      throw CustomException("\tMessage history is not that long.\n");
+    }
+    const std::size_t record{(current_ + history_size_ - age) % history_size_};
+    const int slot{records_[record].slot_of[type_index(message_type)]};
+    return {slot_data(record, slot), records_[record].lengths[slot]};
+  }
+
+  bool is_empty() const {
+    return get_message(MessageType::encoded).empty() &&
+           get_message(MessageType::decoded).empty();
+  }
+
+  void clear_message_buffer() {
+    reset_record(current_);
+    std::cout << "\n\tAll stored messages have been wiped." << std::endl;
+  }
+};
+
+class Driver {
+ private:
+  std::shared_ptr<FileOperations> file_operations_;
+  std::shared_ptr<EncoderDecoder> encoder_decoder_;
+  std::shared_ptr<MessageBuffer> message_buffer_;
+  std::shared_ptr<BatchProcessor> batch_processor_;
+  std::shared_ptr<IncrementalEncoder> composer_;
+
+  std::string get_input_message() {
+    clear_input_buffer();
+    std::cout << "\nWARNING: This will clear all message buffers, leave blank "
+                 "to return.\n"
+              << "Enter the message: ";
+    std::string message;
+    std::getline(std::cin, message);
+    if (message.empty()) {
+      throw CustomException("\tNo message entered by user.");
+    }
+    message.resize(normalise_in_place(&message[0], message.length()));
+    if (message.length() < 2) {
+      throw CustomException("\tMessage must be more than one character.");
+    }
+    return message;
+  }
+
+  void display_messages(const std::vector<std::string_view> &messages) {
+    int message_count{1};
+    for (const auto &message : messages) {
+      std::cout << "\tMessage " << message_count++ << ": " << message << '\n';
+    }
+  }
+
+  void process_message_selection(const std::vector<std::string_view> &messages) {
+    std::cout << "\nWARNING: This will clear all message buffers (enter 0 to "
+                 "return, -1 encode all, -2 decode all).\n"
+              << "Select desired message to save to buffer: ";
+    int message_selection;
+    while (!(std::cin >> message_selection) || message_selection < 0 ||
+           message_selection > messages.size()) {
+      switch (message_selection) {
+        case (0): {
+          throw CustomException("\tReturning to main menu...");
+        }
+        case (-1): {
+          encode_all_messages(messages);
+          return;
+        }
+        case (-2): {
+          decode_all_messages(messages);
+          return;
+        }
+        default: {
+          std::cout << "\tInvalid input (enter 0 to return)...\n"
+                    << "Select a message between 1 and " << messages.size()
+                    << ": ";
+          clear_input_buffer();
+        }
+      }
+    }
+    // Valid message selection
+    message_buffer_->set_message(messages[message_selection - 1],
+                                 MessageType::raw);
+  }
+
+  void encode_all_messages(const std::vector<std::string_view> &messages) {
+    std::cout << "Encoding all messages to new file...\n";
+    process_messages(batch_processor_->encode_all(messages));
+  }
+
+  void decode_all_messages(const std::vector<std::string_view> &messages) {
+    std::cout << "Decoding all messages to new file.\n";
+    process_messages(batch_processor_->decode_all(messages));
+  }
+
+  void process_messages(const std::vector<std::string> &messages) {
+    messages.empty()
+        ? throw CustomException("Failed to process... Check contents of file.")
+        : file_operations_->save_to_file(messages);
+    display_statistics();
+  }
+
+  void display_statistics() {
+    std::cout << "Session statistics:\n" << global_statistics.summary();
+  }
+
+  void display_composition() {
+    std::cout << "\tMessage: " << composer_->message() << '\n'
+              << "\tEncoded (" << composer_->grid_size() << 'x'
+              << composer_->grid_size() << ", full encodes: "
+              << composer_->full_encode_count()
+              << "): " << composer_->encoded_message() << '\n'
+              << "Edit: ";
+  }
+
+  // Applies one edit command; positions count from 1 and TEXT follows a
+  // single space, so it may itself start with spaces.
+  void apply_edit(const std::string &command) {
+    const char operation{static_cast<char>(std::tolower(command[0]))};
+    std::istringstream arguments{command.substr(1)};
+    std::size_t position{0};
+    std::size_t count{0};
+    if (operation != 'a' && (!(arguments >> position) || position < 1)) {
+      throw CustomException("\tInvalid position. Positions start from 1.");
+    }
+    if (operation == 'd' && !(arguments >> count)) {
+      throw CustomException("\tInvalid number of characters to delete.");
+    }
+    arguments.get();
+    std::string text;
+    std::getline(arguments, text);
+    text.resize(normalise_in_place(&text[0], text.length()));
+
+    switch (operation) {
+      case 'a': {
+        composer_->append(text);
+        break;
+      }
+      case 'i': {
+        composer_->insert(position - 1, text);
+        break;
+      }
+      case 'r': {
+        composer_->replace(position - 1, text);
+        break;
+      }
+      case 'd': {
+        composer_->erase(position - 1, count);
+        break;
+      }
+      default: {
+        throw CustomException("\tUnknown edit command.");
+      }
+    }
+  }
+
+ public:
+  Driver()
+      : file_operations_{std::make_shared<FileOperations>()},
+        encoder_decoder_{std::make_shared<EncoderDecoder>()},
+        message_buffer_{std::make_shared<MessageBuffer>()},
+        batch_processor_{std::make_shared<BatchProcessor>()},
+        composer_{std::make_shared<IncrementalEncoder>()} {}
+
+  void get_message_from_user() {
+    message_buffer_->set_message(get_input_message(), MessageType::raw);
+  }
+
+  void get_messages_from_file() {
+    const std::unique_ptr<MessageFile> message_file{
+        file_operations_->load_from_file()};
+    display_messages(message_file->messages());
+    process_message_selection(message_file->messages());
+  }
+
+  void encode_user_message() {
+    if (!message_buffer_->get_message(MessageType::decoded).empty()) {
+      std::cout << "\tFound decoded message in buffer: "
+                << message_buffer_->get_message(MessageType::decoded) << '\n';
+      if (get_user_choice("Would you like to encode this? (y/n): ") == 'Y') {
+        message_buffer_->set_message(
+            encoder_decoder_->encode(
+                message_buffer_->get_message(MessageType::decoded)),
+            MessageType::encoded);
+        return;
+      }
+    }
+
+    if (message_buffer_->get_message(MessageType::raw).empty()) {
+      std::cout
+          << "\tNo raw messages in buffer. Getting new message from user..."
+          << std::endl;
+      get_message_from_user();
+    }
+    message_buffer_->set_message(
+        encoder_decoder_->encode(
+            message_buffer_->get_message(MessageType::raw)),
+        MessageType::encoded);
+  }
+
+  void decode_user_message() {
+    if (!message_buffer_->get_message(MessageType::encoded).empty()) {
+      std::cout << "\tFound encoded message in buffer: "
+                << message_buffer_->get_message(MessageType::encoded) << '\n';
+      if (get_user_choice("Would you like to decode this? (y/n): ") == 'Y') {
+        message_buffer_->set_message(
+            encoder_decoder_->decode(
+                message_buffer_->get_message(MessageType::encoded)),
+            MessageType::decoded);
+        return;
+      }
+    }
+
+    if (message_buffer_->get_message(MessageType::raw).empty()) {
+      std::cout
+          << "\tNo raw messages in buffer. Getting new message from user..."
+          << std::endl;
+      get_message_from_user();
+    }
+    message_buffer_->set_message(
+        encoder_decoder_->decode(
+            message_buffer_->get_message(MessageType::raw)),
+        MessageType::decoded);
+  }
+
+  // Edits the buffered message with its encoding updated after every edit.
+  // The composer keeps its grid between visits, so returning to the same
+  // message carries on without encoding it again.
+  void compose_user_message() {
+    std::string_view message{message_buffer_->get_message(MessageType::raw)};
+    if (message.empty()) {
+      message = message_buffer_->get_message(MessageType::decoded);
+    }
+    if (message.empty()) {
+      std::cout << "\tNo message in buffer. Getting new message from user..."
+                << std::endl;
+      get_message_from_user();
+      message = message_buffer_->get_message(MessageType::raw);
+    } else {
+      clear_input_buffer();
+    }
+    composer_->assign(message);
+
+    std::cout << "Edit commands (positions count from 1, leave blank to "
+                 "finish):\n"
+              << "\ta TEXT    Append TEXT\n"
+              << "\ti K TEXT  Insert TEXT before character K\n"
+              << "\tr K TEXT  Replace characters from K with TEXT\n"
+              << "\td K N     Delete N characters from K\n";
+    std::string command;
+    display_composition();
+    while (std::getline(std::cin, command) && !command.empty()) {
+      try {
+        apply_edit(command);
+      } catch (const CustomException &e) {
+        std::cerr << e.what() << '\n';
+      }
+      display_composition();
+    }
+    std::cout << '\n';
+    message_buffer_->set_message(composer_->message(), MessageType::raw);
+    message_buffer_->set_message(composer_->encoded_message(),
+                                 MessageType::encoded);
+  }
+
+  void stream_file_messages() {
+    const bool encode_flag{
+        get_user_choice("Encode a plaintext file? (n to decode a stream): ") ==
+        'Y'};
+    std::ifstream input{file_operations_->open_stream_input()};
+    std::ofstream output{file_operations_->open_stream_output()};
+
+    StreamCodec stream_codec;
+    const auto start{std::chrono::steady_clock::now()};
+    std::uintmax_t total_bytes{0};
+    {
+      StageTimer timer{encode_flag ? Stage::encode : Stage::decode};
+      total_bytes = encode_flag ? stream_codec.encode_stream(input, output)
+                                : stream_codec.decode_stream(input, output);
+      timer.set_bytes(total_bytes);
+    }
+    const std::chrono::duration<double> elapsed{
+        std::chrono::steady_clock::now() - start};
+
+    const double megabytes{static_cast<double>(total_bytes) / 1e6};
+    std::cout << '\t' << (encode_flag ? "Encoded " : "Decoded ")
+              << total_bytes << " bytes in " << std::fixed
+              << std::setprecision(3) << elapsed.count() << "s ("
+              << std::setprecision(2)
+              << (elapsed.count() > 0 ? megabytes / elapsed.count() : 0.0)
+              << " MB/s)" << std::defaultfloat << std::endl;
+    display_statistics();
+  }
+
+  void save_messages_to_file() {
+    if (message_buffer_->is_empty()) {
+      throw CustomException(
+          "Buffer is empty. No encoded / decoded messages to save.");
+    }
+    file_operations_->save_to_file(
+        {std::string(message_buffer_->get_message(MessageType::encoded)),
+         std::string(message_buffer_->get_message(MessageType::decoded))});
+    message_buffer_->clear_message_buffer();
+  }
+};
+
+class UserInterface {
+ private:
+  int get_menu_option() {
+    std::cout << '\n'
+              << "*****************************************************\n"
+              << "* 1, Enter a message                                *\n"
+              << "* 2, Load a message from a file                     *\n"
+              << "* 3, Encode a message                               *\n"
+              << "* 4, Decode a message                               *\n"
+              << "* 5, Save the message & decoded message to a file.  *\n"
+              << "* 6, Stream-encode / decode a large file            *\n"
+              << "* 7, Edit the message with live encoding            *\n"
+              << "* 8, Quit                                           *\n"
+              << "*****************************************************\n"
+              << "Select option: ";
+    int menu_option;
+    while (!(std::cin >> menu_option) || menu_option < 1 || menu_option > 8) {
+      std::cout
+          << "Invalid input. Please enter a menu option between 1 and 8: ";
+      clear_input_buffer();
+    }
+    return menu_option;
+  }
+
+ public:
+  void run_coder() {
+    global_statistics.enable();
+    std::unique_ptr<Driver> driver_{std::make_unique<Driver>()};
+
+    constexpr int num_options{8};
+    using OptionFunction = void (Driver::*)();
+    OptionFunction options[num_options] = {
+        &Driver::get_message_from_user, &Driver::get_messages_from_file,
+        &Driver::encode_user_message, &Driver::decode_user_message,
+        &Driver::save_messages_to_file, &Driver::stream_file_messages,
+        &Driver::compose_user_message};
+
+    // Loop until user enters option '8'
+    int option{get_menu_option()};
+    while (option != num_options) {
+      try {
+        if (option > 0 && option <= num_options) {
+          (driver_.get()->*options[option - 1])();
+        } else {
+          std::cerr << "\tInvalid option.\n";
+        }
+      } catch (const CustomException &e) {
+        std::cerr << e.what() << '\n';
+      }
+      option = get_menu_option();
+    }
+    std::cout << "\tExiting program..." << std::endl;
+  }
+};
+
+// Times the codec at every odd grid size and the batch paths across batch
+// sizes and thread counts, reporting ns/message, MB/s and heap allocations
+// per message as a table or JSON.
+class Benchmark {
+ private:
+  struct Result {
+    std::string name;
+    int grid_size;
+    std::size_t batch_size;
+    int thread_count;
+    double ns_per_message;
+    double megabytes_per_second;
+    // Negative unless the build counts allocations.
+    double allocations_per_message;
+  };
+
+  std::chrono::duration<double> min_time_;
+  int max_thread_count_;
+  std::vector<Result> results_;
+  std::size_t sink_;
+
+  static std::string random_message(Xoshiro256 &generator, std::size_t length) {
+    std::string message(length, '\0');
+    generator.fill_letters(&message[0], length);
+    return message;
+  }
+
+  // Repeats run_once until min_time_ has passed; run_once handles
+  // message_count messages totalling byte_count bytes.
+  template <typename Operation>
+  void measure(const std::string &name, int grid_size, std::size_t batch_size,
+               int thread_count, std::size_t message_count,
+               std::size_t byte_count, Operation run_once) {
+    run_once();
+    global_allocation_count.store(0);
+    global_count_allocations.store(true);
+    std::uint64_t runs{0};
+    const auto start{std::chrono::steady_clock::now()};
+    std::chrono::duration<double> elapsed{0};
+    do {
+      run_once();
+      ++runs;
+      elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed < min_time_);
+    global_count_allocations.store(false);
+
+    const double messages{static_cast<double>(runs * message_count)};
+    results_.push_back(
+        {name, grid_size, batch_size, thread_count,
+         elapsed.count() * 1e9 / messages,
+         static_cast<double>(runs * byte_count) / 1e6 / elapsed.count(),
+         is_counting_allocations
+             ? static_cast<double>(global_allocation_count.load()) / messages
+             : -1.0});
+  }
+
+  void run_grid_sizes() {
+    Xoshiro256 generator{1};
+    EncoderDecoder encoder_decoder;
+    encoder_decoder.set_padding_source(std::make_shared<SeededPadding>(1));
+    DiamondCodec codec{std::make_shared<SeededPadding>(1)};
+    SeededPadding padding{1};
+    std::vector<char> buffer(square(global_max_size));
+    std::vector<char> group_buffer(decode_group_size *
+                                   decoded_length(global_max_size));
+    const char *group_inputs[decode_group_size];
+    char *group_outputs[decode_group_size];
+
+    for (int grid_size{3}; grid_size <= global_max_size; grid_size += 2) {
+      const std::string message{
+          random_message(generator, decoded_length(grid_size))};
+      const std::string encoded_message{
+          encoder_decoder.encode(message, grid_size)};
+      const std::size_t length{message.length()};
+      const std::size_t encoded_length{encoded_message.length()};
+      for (std::size_t lane{0}; lane < decode_group_size; lane++) {
+        group_inputs[lane] = encoded_message.data();
+        group_outputs[lane] =
+            group_buffer.data() + lane * decoded_length(global_max_size);
+      }
+
+      measure("encode", grid_size, 1, 1, 1, length, [&] {
+        sink_ += encoder_decoder.encode(message, grid_size).size();
+      });
+      measure("decode", grid_size, 1, 1, 1, encoded_length, [&] {
+        sink_ += encoder_decoder.decode(encoded_message).size();
+      });
+      // Pad and scatter / gather through the cached PermutationCache path,
+      // as the codec did before the Codec<N> kernels, so the two engines
+      // can be compared at every size.
+      const std::vector<int> &path{*PermutationCache::get_path(grid_size)};
+      measure("path_encode", grid_size, 1, 1, 1, length, [&] {
+        padding.fill(buffer.data(), encoded_length,
+                     hash_message(message, grid_size));
+        for (std::size_t index{0}; index < length; index++) {
+          if (message[index] != ' ') {
+            buffer[path[index]] = message[index];
+          }
+        }
+        sink_ += static_cast<unsigned char>(buffer[path[0]]);
+      });
+      measure("path_decode", grid_size, 1, 1, 1, encoded_length, [&] {
+        for (std::size_t index{0}; index < length; index++) {
+          buffer[index] = encoded_message[path[index]];
+        }
+        sink_ += static_cast<unsigned char>(buffer[0]);
+      });
+      measure("codec_encode", grid_size, 1, 1, 1, length, [&] {
+        sink_ += codec.encode(message, buffer.data(), buffer.size(), grid_size);
+      });
+      measure("codec_decode", grid_size, 1, 1, 1, encoded_length, [&] {
+        sink_ += codec.decode(encoded_message, buffer.data(), buffer.size());
+      });
+      measure("decode_group", grid_size, decode_group_size, 1,
+              decode_group_size, decode_group_size * encoded_length, [&] {
+                DiamondCodec::decode_group(grid_size, group_inputs,
+                                           group_outputs, decode_group_size);
+                sink_ += static_cast<unsigned char>(group_outputs[0][0]);
+              });
+      measure("decode_closed_form", grid_size, 1, 1, 1, encoded_length, [&] {
+        sink_ += encoder_decoder
+                     .decode_prefix(encoded_message, decoded_length(grid_size))
+                     .size();
+      });
+      measure("path_walk", grid_size, 1, 1, 1, length, [&] {
+        sink_ += PermutationCache::build_path(grid_size).size();
+      });
+    }
+  }
+
+  void run_batches() {
+    Xoshiro256 generator{2};
+    std::vector<int> thread_counts;
+    for (int thread_count{1}; thread_count < max_thread_count_;
+         thread_count *= 2) {
+      thread_counts.push_back(thread_count);
+    }
+    thread_counts.push_back(max_thread_count_);
+
+    for (std::size_t batch_size : {1000, 10000, 100000}) {
+      std::vector<std::string> messages(batch_size);
+      std::size_t message_bytes{0};
+      for (auto &message : messages) {
+        message = random_message(
+            generator, 2 + generator.next() % (decoded_length(global_max_size) - 1));
+        message_bytes += message.length();
+      }
+      const std::vector<std::string_view> message_views(messages.begin(),
+                                                        messages.end());
+
+      for (int thread_count : thread_counts) {
+        BatchProcessor batch_processor{static_cast<std::size_t>(thread_count)};
+        batch_processor.set_padding_source(std::make_shared<SeededPadding>(2));
+        const std::vector<std::string> encoded_messages{
+            batch_processor.encode_all(message_views)};
+        const std::vector<std::string_view> encoded_views(
+            encoded_messages.begin(), encoded_messages.end());
+        std::size_t encoded_bytes{0};
+        for (const auto &encoded_message : encoded_messages) {
+          encoded_bytes += encoded_message.length();
+        }
+
+        measure("batch_encode", 0, batch_size, thread_count, batch_size,
+                message_bytes, [&] {
+                  sink_ += batch_processor.encode_all(message_views).size();
+                });
+        measure("batch_decode", 0, batch_size, thread_count, batch_size,
+                encoded_bytes, [&] {
+                  sink_ += batch_processor.decode_all(encoded_views).size();
+                });
+      }
+    }
+  }
+
+ public:
+  Benchmark(std::chrono::duration<double> min_time, int max_thread_count)
+      : min_time_{min_time}, max_thread_count_{max_thread_count}, sink_{0} {}
+
+  void run() {
+    run_grid_sizes();
+    run_batches();
+  }
+
+  void report(std::ostream &output) const {
+    output << std::left << std::setw(22) << "benchmark" << std::right
+           << std::setw(6) << "grid" << std::setw(8) << "batch"
+           << std::setw(9) << "threads" << std::setw(14) << "ns/message"
+           << std::setw(12) << "MB/s" << std::setw(14) << "allocs/msg"
+           << '\n'
+           << std::fixed;
+    for (const auto &result : results_) {
+      output << std::left << std::setw(22) << result.name << std::right
+             << std::setw(6) << result.grid_size << std::setw(8)
+             << result.batch_size << std::setw(9) << result.thread_count
+             << std::setprecision(1) << std::setw(14) << result.ns_per_message
+             << std::setw(12) << result.megabytes_per_second
+             << std::setprecision(2) << std::setw(14);
+      if (result.allocations_per_message < 0) {
+        output << '-';
+      } else {
+        output << result.allocations_per_message;
+      }
+      output << '\n';
+    }
+    output << std::defaultfloat;
+  }
+
+  void report_json(std::ostream &output) const {
+    output << "{\"benchmarks\": [";
+    for (std::size_t index{0}; index < results_.size(); index++) {
+      const Result &result{results_[index]};
+      output << (index == 0 ? "\n" : ",\n") << "  {\"name\": \""
+             << result.name << "\", \"grid_size\": " << result.grid_size
+             << ", \"batch_size\": " << result.batch_size
+             << ", \"threads\": " << result.thread_count
+             << ", \"ns_per_message\": " << result.ns_per_message
+             << ", \"megabytes_per_second\": " << result.megabytes_per_second
+             << ", \"allocations_per_message\": ";
+      if (result.allocations_per_message < 0) {
+        output << "null";
+      } else {
+        output << result.allocations_per_message;
+      }
+      output << "}";
+    }
+    output << "\n]}\n";
+  }
+};
+
+// Non-interactive batch mode, e.g.
+//   encrypt_messages encode --auto -i messages.txt -o encoded.txt
+// Messages are read one per line and written in input order, with failures
+// marked 'FE::' / 'FD::' as in the menu's encode / decode all options.
+#if defined(__linux__)
+// Wire format of the codec daemon. Every request and response is a 12 byte
+// little-endian header followed by its payload:
+//   request   u32 id, u8 operation (0 encode, 1 decode), u8 reserved,
+//             u16 grid size (0 picks the smallest), u32 payload length
+//   response  u32 id, u8 status (0 ok, 1 failed), u8 reserved,
+//             u16 grid size, u32 payload length
+// Responses echo the id of their request and may arrive out of order. A
+// failed response carries the error message as its payload.
+class CodecProtocol {
+ public:
+  enum class Operation : std::uint8_t { encode, decode };
+  enum class Status : std::uint8_t { ok, failed };
+
+  struct Header {
+    std::uint32_t id;
+    std::uint8_t code;
+    std::uint16_t grid_size;
+    std::uint32_t length;
+  };
+
+  static constexpr std::size_t header_size{12};
+  static constexpr std::uint32_t max_payload_length{1 << 20};
+
+  static void append_frame(std::string &buffer, std::uint32_t id,
+                           std::uint8_t code, std::uint16_t grid_size,
+                           std::string_view payload) {
+    char header[header_size]{};
+    put_little_endian(header, id, 4);
+    put_little_endian(header + 4, code, 1);
+    put_little_endian(header + 6, grid_size, 2);
+    put_little_endian(header + 8, payload.length(), 4);
+    buffer.append(header, header_size);
+    buffer += payload;
+  }
+
+  static Header read_header(const char *data) {
+    return {static_cast<std::uint32_t>(get_little_endian(data, 4)),
+            static_cast<std::uint8_t>(get_little_endian(data + 4, 1)),
+            static_cast<std::uint16_t>(get_little_endian(data + 6, 2)),
+            static_cast<std::uint32_t>(get_little_endian(data + 8, 4))};
+  }
+
+  static sockaddr_un socket_address(const std::string &socket_path) {
+    sockaddr_un address{};
+    if (socket_path.length() >= sizeof(address.sun_path)) {
+      throw CustomException("\tSocket path is too long.");
+    }
+    address.sun_family = AF_UNIX;
+    std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+    return address;
+  }
+};
+
+// A request on its way from the event loop to a worker and back with its
+// response.
+struct CodecRequest {
+  std::uint64_t connection_id;
+  CodecProtocol::Header header;
+  std::string payload;
+  std::string response;
+  CodecProtocol::Status status;
+};
+
+using RequestBatch = std::vector<CodecRequest>;
+
+// Serves encode / decode requests on a Unix domain socket until SIGINT or
+// SIGTERM. A single epoll loop accepts connections, parses requests and
+// writes responses. The requests read in one pass of the loop are handed to
+// the workers in batches of up to batch_size_ through a lock-free queue, so
+// many small requests cost one hand-off; finished batches come back through
+// a second queue and an eventfd. Each worker owns its EncoderDecoder and the
+// scratch buffers in it.
+class CodecServer {
+ private:
+  struct Connection {
+    int file_descriptor;
+    std::string input;
+    std::string output;
+    std::size_t output_offset;
+    std::size_t pending_count;
+    std::uint32_t watched_events;
+    bool is_flush_pending;
+    bool is_read_closed;
+  };
+
+  static constexpr std::size_t batch_size_{64};
+  static constexpr std::size_t queue_capacity_{1024};
+  static constexpr std::size_t read_size_{1 << 16};
+  // A connection stops being read while it has this many requests in
+  // flight or this many bytes of responses not yet written.
+  static constexpr std::size_t max_pending_requests_{4096};
+  static constexpr std::size_t max_pending_output_{1 << 20};
+  static constexpr int spin_count_{64};
+  static constexpr std::uint64_t listen_id_{0};
+  static constexpr std::uint64_t completion_id_{1};
+  static constexpr std::uint64_t signal_id_{2};
+
+  std::string socket_path_;
+  std::size_t thread_count_;
+  std::shared_ptr<PaddingSource> padding_source_;
+  MpmcQueue<std::unique_ptr<RequestBatch>> pending_batches_;
+  MpmcQueue<std::unique_ptr<RequestBatch>> finished_batches_;
+  std::unordered_map<std::uint64_t, Connection> connections_;
+  std::unique_ptr<RequestBatch> batch_;
+  std::vector<std::uint64_t> flush_ids_;
+  std::uint64_t next_connection_id_;
+  std::uintmax_t request_count_;
+  int epoll_descriptor_;
+  int listen_descriptor_;
+  int completion_descriptor_;
+  int signal_descriptor_;
+  std::mutex idle_mutex_;
+  std::condition_variable idle_;
+  std::atomic<int> idle_count_;
+  std::atomic<bool> is_stopping_;
+
+  void watch(int file_descriptor, std::uint64_t id, std::uint32_t events,
+             int operation = EPOLL_CTL_ADD) {
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id;
+    if (::epoll_ctl(epoll_descriptor_, operation, file_descriptor, &event) !=
+        0) {
+      throw CustomException("\tError registering socket with epoll.");
+    }
+  }
+
+  void open_socket() {
+    const sockaddr_un address{CodecProtocol::socket_address(socket_path_)};
+    listen_descriptor_ =
+        ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_descriptor_ < 0) {
+      throw CustomException("\tError creating socket.");
+    }
+    // A stale socket file from an earlier run would make bind fail.
+    ::unlink(socket_path_.c_str());
+    if (::bind(listen_descriptor_,
+               reinterpret_cast<const sockaddr *>(&address),
+               sizeof(address)) != 0 ||
+        ::listen(listen_descriptor_, SOMAXCONN) != 0) {
+      throw CustomException("\tError listening on socket.");
+    }
+  }
+
+  std::unique_ptr<RequestBatch> take_batch() {
+    std::unique_ptr<RequestBatch> batch;
+    for (int spin{0}; spin < spin_count_; spin++) {
+      if (pending_batches_.try_pop(batch)) {
+        return batch;
+      }
+      std::this_thread::yield();
+    }
+    // Sleep until a batch is submitted. The queue is checked again under the
+    // lock the submitter takes to notify. The fence pairs with the one in
+    // submit_batch: either the submitter sees this worker counted as idle
+    // and notifies it, or this worker sees the submitted batch, so no
+    // wake-up is lost.
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_count_++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!pending_batches_.try_pop(batch) && !is_stopping_) {
+      idle_.wait(lock);
+    }
+    idle_count_--;
+    return batch;
+  }
+
+  static void process_request(EncoderDecoder &encoder_decoder,
+                              CodecRequest &request) {
+    request.status = CodecProtocol::Status::ok;
+    request.payload.resize(
+        normalise_in_place(&request.payload[0], request.payload.length()));
+    if (request.payload.empty()) {
+      request.response.clear();
+      return;
+    }
+    CodecResult<std::string> result{
+        request.header.code ==
+                static_cast<std::uint8_t>(CodecProtocol::Operation::encode)
+            ? encoder_decoder.try_encode(
+                  request.payload, static_cast<int>(request.header.grid_size))
+            : encoder_decoder.try_decode(request.payload)};
+    if (result) {
+      request.response = std::move(result).value();
+      return;
+    }
+    request.status = CodecProtocol::Status::failed;
+    request.response = codec_error_message(result.error());
+    request.response.erase(0, request.response.find_first_not_of('\t'));
+  }
+
+  void run_worker() {
+    EncoderDecoder encoder_decoder;
+    encoder_decoder.set_padding_source(padding_source_);
+    while (true) {
+      std::unique_ptr<RequestBatch> batch{take_batch()};
+      if (!batch) {
+        return;
+      }
+      for (auto &request : *batch) {
+        process_request(encoder_decoder, request);
+      }
+      while (!finished_batches_.try_push(batch)) {
+        if (is_stopping_) {
+          return;
+        }
+        std::this_thread::yield();
+      }
+      const std::uint64_t signal{1};
+      if (::write(completion_descriptor_, &signal, sizeof(signal)) < 0 &&
+          errno != EAGAIN) {
+        return;
+      }
+    }
+  }
+
+  // Hands the current batch to the workers, returning finished batches
+  // while the queue is full so neither side can wait on the other forever.
+  void submit_batch() {
+    if (!batch_ || batch_->empty()) {
+      return;
+    }
+    while (!pending_batches_.try_push(batch_)) {
+      finish_batches();
+      std::this_thread::yield();
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idle_count_ > 0) {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      idle_.notify_one();
+    }
+  }
+
+  void close_connection(std::uint64_t id) {
+    const auto connection{connections_.find(id)};
+    if (connection == connections_.end()) {
+      return;
+    }
+    ::epoll_ctl(epoll_descriptor_, EPOLL_CTL_DEL,
+                connection->second.file_descriptor, nullptr);
+    ::close(connection->second.file_descriptor);
+    connections_.erase(connection);
+  }
+
+  void accept_connections() {
+    while (true) {
+      const int file_descriptor{::accept4(listen_descriptor_, nullptr, nullptr,
+                                          SOCK_NONBLOCK | SOCK_CLOEXEC)};
+      if (file_descriptor < 0) {
+        return;
+      }
+      const std::uint64_t id{next_connection_id_++};
+      connections_[id] = Connection{
+          file_descriptor, {}, {}, 0, 0, EPOLLIN | EPOLLRDHUP, false, false};
+      watch(file_descriptor, id, EPOLLIN | EPOLLRDHUP);
+    }
+  }
+
+  // A client that sends requests without reading the responses is paused
+  // until they drain, so neither its requests nor its output grow without
+  // bound.
+  static bool is_read_paused(const Connection &connection) {
+    return connection.pending_count >= max_pending_requests_ ||
+           connection.output.length() - connection.output_offset >=
+               max_pending_output_;
+  }
+
+  // Input is watched until the peer shuts down its side and while the
+  // connection is not paused, output only while responses are left over.
+  void update_events(std::uint64_t id, Connection &connection) {
+    const std::uint32_t events{
+        (connection.is_read_closed || is_read_paused(connection)
+             ? 0u
+             : EPOLLIN | EPOLLRDHUP) |
+        (connection.output_offset < connection.output.length() ? EPOLLOUT
+                                                               : 0u)};
+    if (events != connection.watched_events) {
+      connection.watched_events = events;
+      watch(connection.file_descriptor, id, events, EPOLL_CTL_MOD);
+    }
+  }
+
+  // A connection whose peer has stopped sending stays open until every
+  // request it sent has been answered and written.
+  static bool is_finished(const Connection &connection) {
+    return connection.is_read_closed && connection.pending_count == 0 &&
+           connection.output_offset == connection.output.length();
+  }
+
+  // Reads what the connection has sent and queues each complete request,
+  // including those that arrived just before the peer shut down its side.
+  // Reading stops early once the connection is paused, so its input never
+  // holds more than one partial request and one read. Returns false once
+  // the connection should be closed.
+  bool read_requests(std::uint64_t id, Connection &connection) {
+    char buffer[read_size_];
+    while (!connection.is_read_closed && !is_read_paused(connection)) {
+      const ssize_t read_length{
+          ::read(connection.file_descriptor, buffer, sizeof(buffer))};
+      if (read_length > 0) {
+        connection.input.append(buffer, static_cast<std::size_t>(read_length));
+        if (!queue_requests(id, connection)) {
+          return false;
+        }
+        continue;
+      }
+      if (read_length == 0) {
+        connection.is_read_closed = true;
+        // A partial request left at end of input can never complete.
+        connection.input.clear();
+        break;
+      }
+      if (errno == EAGAIN) {
+        break;
+      }
+      if (errno != EINTR) {
+        return false;
+      }
+    }
+    update_events(id, connection);
+    return true;
+  }
+
+  // Queues each complete request in the connection's input. Returns false
+  // for a malformed header.
+  bool queue_requests(std::uint64_t id, Connection &connection) {
+    std::size_t offset{0};
+    while (connection.input.length() - offset >= CodecProtocol::header_size) {
+      const CodecProtocol::Header header{
+          CodecProtocol::read_header(connection.input.data() + offset)};
+      if (header.length > CodecProtocol::max_payload_length ||
+          header.code >
+              static_cast<std::uint8_t>(CodecProtocol::Operation::decode)) {
+        return false;
+      }
+      if (connection.input.length() - offset <
+          CodecProtocol::header_size + header.length) {
+        break;
+      }
+      if (!batch_) {
+        batch_ = std::make_unique<RequestBatch>();
+        batch_->reserve(batch_size_);
+      }
+      batch_->push_back(CodecRequest{
+          id, header,
+          connection.input.substr(offset + CodecProtocol::header_size,
+                                  header.length),
+          {}, CodecProtocol::Status::ok});
+      offset += CodecProtocol::header_size + header.length;
+      connection.pending_count++;
+      request_count_++;
+      if (batch_->size() == batch_size_) {
+        submit_batch();
+      }
+    }
+    connection.input.erase(0, offset);
+    return true;
+  }
+
+  // Writes as much pending output as the socket takes, then updates what
+  // the connection is watched for.
+  bool write_responses(std::uint64_t id, Connection &connection) {
+    while (connection.output_offset < connection.output.length()) {
+      const ssize_t written{::send(
+          connection.file_descriptor,
+          connection.output.data() + connection.output_offset,
+          connection.output.length() - connection.output_offset,
+          MSG_NOSIGNAL)};
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EAGAIN) {
+          return false;
+        }
+        break;
+      }
+      connection.output_offset += static_cast<std::size_t>(written);
+    }
+    const bool is_drained{connection.output_offset ==
+                          connection.output.length()};
+    if (is_drained) {
+      connection.output.clear();
+      connection.output_offset = 0;
+    }
+    update_events(id, connection);
+    return true;
+  }
+
+  void finish_batches() {
+    std::unique_ptr<RequestBatch> batch;
+    while (finished_batches_.try_pop(batch)) {
+      for (const auto &request : *batch) {
+        const auto connection{connections_.find(request.connection_id)};
+        if (connection == connections_.end()) {
+          continue;
+        }
+        connection->second.pending_count--;
+        const int grid_size{
+            request.status == CodecProtocol::Status::ok &&
+                    request.header.code ==
+                        static_cast<std::uint8_t>(
+                            CodecProtocol::Operation::encode)
+                ? static_cast<int>(integer_sqrt(request.response.length()))
+                : 0};
+        CodecProtocol::append_frame(
+            connection->second.output, request.header.id,
+            static_cast<std::uint8_t>(request.status),
+            static_cast<std::uint16_t>(grid_size), request.response);
+        if (!connection->second.is_flush_pending) {
+          connection->second.is_flush_pending = true;
+          flush_ids_.push_back(request.connection_id);
+        }
+      }
+    }
+  }
+
+  void flush_connections() {
+    for (const std::uint64_t id : flush_ids_) {
+      const auto connection{connections_.find(id)};
+      if (connection == connections_.end()) {
+        continue;
+      }
+      connection->second.is_flush_pending = false;
+      if (!write_responses(id, connection->second) ||
+          is_finished(connection->second)) {
+        close_connection(id);
+      }
+    }
+    flush_ids_.clear();
+  }
+
+  void run_event_loop() {
+    constexpr int max_events{64};
+    epoll_event events[max_events];
+    while (true) {
+      const int event_count{
+          ::epoll_wait(epoll_descriptor_, events, max_events, -1)};
+      if (event_count < 0 && errno != EINTR) {
+        throw CustomException("\tError waiting for socket events.");
+      }
+      for (int index{0}; index < event_count; index++) {
+        const std::uint64_t id{events[index].data.u64};
+        if (id == signal_id_) {
+          return;
+        }
+        if (id == listen_id_) {
+          accept_connections();
+          continue;
+        }
+        if (id == completion_id_) {
+          std::uint64_t signal_count;
+          while (::read(completion_descriptor_, &signal_count,
+                        sizeof(signal_count)) > 0) {
+          }
+          finish_batches();
+          continue;
+        }
+        const auto connection{connections_.find(id)};
+        if (connection == connections_.end()) {
+          continue;
+        }
+        bool is_open{true};
+        if (events[index].events & EPOLLOUT) {
+          is_open = write_responses(id, connection->second);
+        }
+        if (is_open && (events[index].events & (EPOLLHUP | EPOLLERR))) {
+          // The peer has gone entirely, so nothing queued can reach it.
+          is_open = false;
+        } else if (is_open &&
+                   (events[index].events & (EPOLLIN | EPOLLRDHUP))) {
+          is_open = read_requests(id, connection->second);
+        }
+        if (!is_open || is_finished(connection->second)) {
+          close_connection(id);
+        }
+      }
+      submit_batch();
+      flush_connections();
+    }
+  }
+
+ public:
+  CodecServer(std::string socket_path, std::size_t thread_count,
+              std::shared_ptr<PaddingSource> padding_source)
+      : socket_path_{std::move(socket_path)},
+        thread_count_{std::max<std::size_t>(thread_count, 1)},
+        padding_source_{std::move(padding_source)},
+        pending_batches_{queue_capacity_},
+        finished_batches_{queue_capacity_},
+        batch_{nullptr},
+        next_connection_id_{signal_id_ + 1},
+        request_count_{0},
+        epoll_descriptor_{-1},
+        listen_descriptor_{-1},
+        completion_descriptor_{-1},
+        signal_descriptor_{-1},
+        idle_count_{0},
+        is_stopping_{false} {}
+
+  ~CodecServer() {
+    for (const auto &connection : connections_) {
+      ::close(connection.second.file_descriptor);
+    }
+    for (const int file_descriptor :
+         {epoll_descriptor_, listen_descriptor_, completion_descriptor_,
+          signal_descriptor_}) {
+      if (file_descriptor >= 0) {
+        ::close(file_descriptor);
+      }
+    }
+    if (listen_descriptor_ >= 0) {
+      ::unlink(socket_path_.c_str());
+    }
+  }
+
+  CodecServer(const CodecServer &) = delete;
+  CodecServer &operator=(const CodecServer &) = delete;
+
+  // Serves until SIGINT or SIGTERM, returning the number of requests read.
+  std::uintmax_t run(std::ostream &log) {
+    // Blocked before the workers start so only the signalfd sees them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    ::pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    epoll_descriptor_ = ::epoll_create1(EPOLL_CLOEXEC);
+    completion_descriptor_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    signal_descriptor_ = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epoll_descriptor_ < 0 || completion_descriptor_ < 0 ||
+        signal_descriptor_ < 0) {
+      throw CustomException("\tError creating event loop.");
+    }
+    open_socket();
+    watch(listen_descriptor_, listen_id_, EPOLLIN);
+    watch(completion_descriptor_, completion_id_, EPOLLIN);
+    watch(signal_descriptor_, signal_id_, EPOLLIN);
+
+    std::vector<std::thread> workers;
+    for (std::size_t worker{0}; worker < thread_count_; worker++) {
+      workers.emplace_back([this] { run_worker(); });
+    }
+    log << "Serving on '" << socket_path_ << "' with " << thread_count_
+        << " worker thread(s).\n";
+    log.flush();
+
+    std::exception_ptr error;
+    try {
+      run_event_loop();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      is_stopping_ = true;
+      idle_.notify_all();
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    log << "Served " << request_count_ << " request(s).\n";
+    return request_count_;
+  }
+};
+
+// Closed-loop load generator for the codec daemon. Each connection keeps
+// window_ requests in flight: it encodes random messages, decodes every
+// grid it gets back and checks the decode returns the message. Latency is
+// measured per request from send to response.
+class LoadGenerator {
+ private:
+  struct ConnectionResult {
+    std::vector<std::uint32_t> latencies_ns;
+    std::uintmax_t failure_count;
+  };
+
+  static constexpr std::size_t window_{16};
+
+  std::string socket_path_;
+  std::size_t connection_count_;
+  std::uintmax_t request_count_;
+  std::size_t message_length_;
+
+  static int connect_socket(const std::string &socket_path) {
+    const sockaddr_un address{CodecProtocol::socket_address(socket_path)};
+    const int file_descriptor{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (file_descriptor < 0 ||
+        ::connect(file_descriptor,
+                  reinterpret_cast<const sockaddr *>(&address),
+                  sizeof(address)) != 0) {
+      if (file_descriptor >= 0) {
+        ::close(file_descriptor);
+      }
+      throw CustomException("\tError connecting to the codec daemon.");
+    }
+    return file_descriptor;
+  }
+
+  static void send_all(int file_descriptor, const std::string &data) {
+    std::size_t offset{0};
+    while (offset < data.length()) {
+      const ssize_t written{::send(file_descriptor, data.data() + offset,
+                                   data.length() - offset, MSG_NOSIGNAL)};
+      if (written < 0 && errno != EINTR) {
+        throw CustomException("\tError sending request.");
+      }
+      offset += written > 0 ? static_cast<std::size_t>(written) : 0;
+    }
+  }
+
+  ConnectionResult run_connection(std::uintmax_t request_count,
+                                  std::uint64_t seed) const {
+    using Operation = CodecProtocol::Operation;
+    struct InFlight {
+      std::chrono::steady_clock::time_point sent;
+      std::string message;
+    };
+
+    ConnectionResult result{{}, 0};
+    result.latencies_ns.reserve(request_count);
+    const int file_descriptor{connect_socket(socket_path_)};
+    Xoshiro256 generator{seed};
+    std::unordered_map<std::uint32_t, InFlight> in_flight;
+    std::uint32_t next_id{0};
+    std::uintmax_t sent_count{0};
+    std::string output;
+    std::string input;
+
+    auto send_request{[&](Operation operation, std::string_view payload,
+                          std::string message) {
+      output.clear();
+      CodecProtocol::append_frame(output, next_id,
+                                  static_cast<std::uint8_t>(operation), 0,
+                                  payload);
+      in_flight[next_id++] = {std::chrono::steady_clock::now(),
+                              std::move(message)};
+      send_all(file_descriptor, output);
+      sent_count++;
+    }};
+    auto send_encode{[&] {
+      std::string message(message_length_, '\0');
+      generator.fill_letters(&message[0], message.length());
+      send_request(Operation::encode, message, message);
+    }};
+
+    try {
+      while (sent_count < std::min<std::uintmax_t>(window_, request_count)) {
+        send_encode();
+      }
+      char buffer[1 << 16];
+      std::size_t offset{0};
+      while (!in_flight.empty()) {
+        const ssize_t read_length{
+            ::read(file_descriptor, buffer, sizeof(buffer))};
+        if (read_length <= 0) {
+          if (read_length < 0 && errno == EINTR) {
+            continue;
+          }
+          throw CustomException("\tCodec daemon closed the connection.");
+        }
+        input.append(buffer, static_cast<std::size_t>(read_length));
+
+        while (input.length() - offset >= CodecProtocol::header_size) {
+          const CodecProtocol::Header header{
+              CodecProtocol::read_header(input.data() + offset)};
+          if (input.length() - offset <
+              CodecProtocol::header_size + header.length) {
+            break;
+          }
+          const auto now{std::chrono::steady_clock::now()};
+          const std::string_view payload{
+              input.data() + offset + CodecProtocol::header_size,
+              header.length};
+          offset += CodecProtocol::header_size + header.length;
+
+          const auto request{in_flight.find(header.id)};
+          if (request == in_flight.end()) {
+            throw CustomException("\tResponse for an unknown request.");
+          }
+          result.latencies_ns.push_back(static_cast<std::uint32_t>(
+              std::min<std::int64_t>(
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      now - request->second.sent)
+                      .count(),
+                  UINT32_MAX)));
+          std::string message{std::move(request->second.message)};
+          in_flight.erase(request);
+
+          const bool is_ok{header.code == static_cast<std::uint8_t>(
+                                              CodecProtocol::Status::ok)};
+          if (!is_ok) {
+            result.failure_count++;
+          }
+          // An encode response is followed by its decode; a decode
+          // response is checked against the original message.
+          const bool is_encode_response{!message.empty() && is_ok &&
+                                        header.grid_size != 0};
+          if (!message.empty() && is_ok && !is_encode_response &&
+              payload.substr(0, message.length()) != message) {
+            result.failure_count++;
+          }
+          if (sent_count < request_count) {
+            is_encode_response
+                ? send_request(Operation::decode, payload, message)
+                : send_encode();
+          }
+        }
+        input.erase(0, offset);
+        offset = 0;
+      }
+    } catch (...) {
+      ::close(file_descriptor);
+      throw;
+    }
+    ::close(file_descriptor);
+    return result;
+  }
+
+ public:
+  LoadGenerator(std::string socket_path, std::size_t connection_count,
+                std::uintmax_t request_count, std::size_t message_length)
+      : socket_path_{std::move(socket_path)},
+        connection_count_{std::max<std::size_t>(connection_count, 1)},
+        request_count_{request_count},
+        message_length_{message_length} {}
+
+  // Runs every connection on its own thread and reports throughput and
+  // latency percentiles. Returns false if any request failed.
+  bool run(std::ostream &output) const {
+    std::vector<ConnectionResult> results(connection_count_);
+    std::vector<std::exception_ptr> errors(connection_count_);
+    std::vector<std::thread> threads;
+    const auto start{std::chrono::steady_clock::now()};
+    for (std::size_t connection{0}; connection < connection_count_;
+         connection++) {
+      const std::uintmax_t share{
+          request_count_ / connection_count_ +
+          (connection < request_count_ % connection_count_ ? 1 : 0)};
+      threads.emplace_back([this, &results, &errors, connection, share] {
+        try {
+          results[connection] = run_connection(share, connection + 1);
+        } catch (...) {
+          errors[connection] = std::current_exception();
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    const double seconds{std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count()};
+    for (const auto &error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+
+    std::vector<std::uint32_t> latencies;
+    std::uintmax_t failure_count{0};
+    for (const auto &result : results) {
+      latencies.insert(latencies.end(), result.latencies_ns.begin(),
+                       result.latencies_ns.end());
+      failure_count += result.failure_count;
+    }
+    auto percentile{[&latencies](double fraction) {
+      if (latencies.empty()) {
+        return 0.0;
+      }
+      const std::size_t rank{std::min(
+          latencies.size() - 1,
+          static_cast<std::size_t>(fraction * latencies.size()))};
+      std::nth_element(latencies.begin(), latencies.begin() + rank,
+                       latencies.end());
+      return latencies[rank] / 1000.0;
+    }};
+
+    output << std::fixed << std::setprecision(1)
+           << "Requests:     " << latencies.size() << '\n'
+           << "Connections:  " << connection_count_ << '\n'
+           << "Seconds:      " << std::setprecision(3) << seconds << '\n'
+           << "Requests/s:   " << std::setprecision(0)
+           << latencies.size() / std::max(seconds, 1e-9) << '\n'
+           << std::setprecision(1)
+           << "Latency p50:  " << percentile(0.50) << " us\n"
+           << "Latency p99:  " << percentile(0.99) << " us\n"
+           << "Latency max:  " << percentile(1.0) << " us\n"
+           << "Failures:     " << failure_count << '\n';
+    return failure_count == 0;
+  }
+};
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+// Runs a line job across worker processes. The input is split into byte
+// ranges on line boundaries and each worker writes its shard's output to a
+// file of its own. Once every shard has succeeded, the outputs are copied
+// in order into an output preallocated to their total size, each with
+// positional writes at its own offset. A worker that crashes or fails is
+// started again for its shard alone, up to attempt_limit_ times.
+class ShardCoordinator {
+ private:
+  // A byte range of the mapped input read as a stream.
+  class RangeBuffer : public std::streambuf {
+   public:
+    RangeBuffer(char *begin, char *end) { setg(begin, begin, end); }
+  };
+
+  struct Shard {
+    std::size_t begin;
+    std::size_t end;
+    std::string file_name;
+    int attempt_count;
+  };
+
+  static constexpr int attempt_limit_{3};
+  static constexpr std::size_t copy_block_size_{1 << 20};
+  static constexpr std::streamsize io_buffer_size_{1 << 16};
+
+  MappedFile input_file_;
+  std::string output_file_name_;
+  std::vector<Shard> shards_;
+
+  // Shard k nominally starts at byte k * size / shard_count and is moved on
+  // to the start of the next line. Shards left empty are dropped.
+  void split_input(std::size_t shard_count) {
+    const char *data{input_file_.data()};
+    const std::size_t size{input_file_.size()};
+    std::size_t begin{0};
+    for (std::size_t shard{1}; shard <= shard_count && begin < size;
+         shard++) {
+      std::size_t end{std::max(begin, size / shard_count * shard)};
+      if (shard == shard_count) {
+        end = size;
+      } else if (end > begin) {
+        const char *newline{static_cast<const char *>(
+            std::memchr(data + end - 1, '\n', size - (end - 1)))};
+        end = newline != nullptr ? static_cast<std::size_t>(newline - data) + 1
+                                 : size;
+      }
+      if (end > begin) {
+        shards_.push_back({begin, end,
+                           output_file_name_ + ".shard" +
+                               std::to_string(shards_.size()),
+                           0});
+      }
+      begin = end;
+    }
+  }
+
+  template <typename ShardJob>
+  static int run_shard(const Shard &shard, char *data, ShardJob &run_job) {
+    try {
+      RangeBuffer range_buffer{data + shard.begin, data + shard.end};
+      std::istream input(&range_buffer);
+      std::vector<char> output_buffer(io_buffer_size_);
+      std::ofstream output;
+      output.rdbuf()->pubsetbuf(output_buffer.data(), io_buffer_size_);
+      output.open(shard.file_name, std::ios::out | std::ios::binary);
+      if (!output.is_open()) {
+        throw CustomException("\tError opening shard output.");
+      }
+      run_job(input, output);
+      output.close();
+      return output ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+
+  // The worker leaves through _exit so nothing the coordinator buffered or
+  // registered is flushed or run twice.
+  template <typename ShardJob>
+  pid_t launch(std::size_t shard, ShardJob &run_job) {
+    shards_[shard].attempt_count++;
+    const pid_t pid{::fork()};
+    if (pid == 0) {
+      const int status{run_shard(shards_[shard], input_file_.data(), run_job)};
+      std::cerr.flush();
+      ::_exit(status);
+    }
+    if (pid < 0) {
+      throw CustomException("\tError starting a shard process.");
+    }
+    return pid;
+  }
+
+  static std::string describe_status(int status) {
+    if (WIFSIGNALED(status)) {
+      return "killed by signal " + std::to_string(WTERMSIG(status));
+    }
+    return "exit status " + std::to_string(WEXITSTATUS(status));
+  }
+
+  void stop_workers(std::unordered_map<pid_t, std::size_t> &running) {
+    for (const auto &worker : running) {
+      ::kill(worker.first, SIGTERM);
+    }
+    for (const auto &worker : running) {
+      ::waitpid(worker.first, nullptr, 0);
+    }
+    running.clear();
+    remove_shard_files();
+  }
+
+  void remove_shard_files() const {
+    for (const auto &shard : shards_) {
+      ::unlink(shard.file_name.c_str());
+    }
+  }
+
+  static void write_fully(int file_descriptor, const char *data,
+                          std::size_t length, std::uint64_t offset) {
+    while (length > 0) {
+      const ssize_t written{::pwrite(file_descriptor, data, length,
+                                     static_cast<off_t>(offset))};
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        throw CustomException("\tError writing output.");
+      }
+      data += written;
+      length -= static_cast<std::size_t>(written);
+      offset += static_cast<std::uint64_t>(written);
+    }
+  }
+
+  void merge_outputs() {
+    StageTimer timer{Stage::save};
+    std::vector<std::uint64_t> offsets;
+    std::uint64_t total_size{0};
+    for (const auto &shard : shards_) {
+      struct stat file_status;
+      if (::stat(shard.file_name.c_str(), &file_status) != 0) {
+        throw CustomException("\tShard output is missing.");
+      }
+      offsets.push_back(total_size);
+      total_size += static_cast<std::uint64_t>(file_status.st_size);
+    }
 
-  void set_message(const std::string message, const MessageType message_type) {
-    if (message.empty()) {
-      throw CustomException("\tNo message entered.\n");
+    const int output{
+        ::open(output_file_name_.c_str(), O_WRONLY | O_CREAT, 0666)};
+    if (output < 0) {
+      throw CustomException("\tError opening output file.");
+    }
+    bool is_allocated{::ftruncate(output, static_cast<off_t>(total_size)) ==
+                      0};
+#if defined(__linux__)
+    if (is_allocated && total_size > 0) {
+      const int error{
+          ::posix_fallocate(output, 0, static_cast<off_t>(total_size))};
+      is_allocated = error == 0 || error == EOPNOTSUPP || error == EINVAL;
+    }
+#endif
+    if (!is_allocated) {
+      ::close(output);
+      throw CustomException("\tError allocating output file.");
     }
 
-    switch (message_type) {
-      case MessageType::raw: {
-        encoded_message_.clear();
-        decoded_message_.clear();
-        std::cout << "\tMessage buffers cleared..." << '\n';
-        raw_message_ = message;
-        std::cout << "\tStored message: " << raw_message_ << std::endl;
-        break;
+    std::vector<char> buffer(copy_block_size_);
+    for (std::size_t index{0}; index < shards_.size(); index++) {
+      const int input{::open(shards_[index].file_name.c_str(), O_RDONLY)};
+      if (input < 0) {
+        ::close(output);
+        throw CustomException("\tError opening shard output.");
       }
-      case MessageType::encoded: {
-        if (!raw_message_.empty()) {
-          decoded_message_ = raw_message_;
-          raw_message_.clear();
+      std::uint64_t offset{0};
+      ssize_t length{0};
+      while ((length = ::pread(input, buffer.data(), buffer.size(),
+                               static_cast<off_t>(offset))) != 0) {
+        if (length < 0 && errno == EINTR) {
+          continue;
         }
-        encoded_message_ = message;
-        std::cout << "\tStored encoded message: " << encoded_message_
-                  << std::endl;
-        break;
-      }
-      case MessageType::decoded: {
-        if (!raw_message_.empty()) {
-          encoded_message_ = raw_message_;
-          raw_message_.clear();
+        if (length < 0) {
+          ::close(input);
+          ::close(output);
+          throw CustomException("\tError reading shard output.");
         }
-        decoded_message_ = message;
-        std::cout << "\tStored decoded message: " << decoded_message_
-                  << std::endl;
-        break;
-      }
-      default: {
-        throw CustomException("\tInvalid message type.\n");
+        write_fully(output, buffer.data(), static_cast<std::size_t>(length),
+                    offsets[index] + offset);
+        offset += static_cast<std::uint64_t>(length);
       }
+      ::close(input);
+      ::unlink(shards_[index].file_name.c_str());
+    }
+    timer.set_bytes(total_size);
+    if (::close(output) != 0) {
+      throw CustomException("\tError writing output.");
     }
   }
 
-  std::string get_message(MessageType message_type) {
-    switch (message_type) {
-      case MessageType::raw: {
-        return raw_message_;
+ public:
+  ShardCoordinator(const std::string &input_file_name,
+                   const std::string &output_file_name,
+                   std::size_t shard_count)
+      : input_file_{input_file_name}, output_file_name_{output_file_name} {
+    split_input(std::max<std::size_t>(shard_count, 1));
+  }
+
+  std::size_t shard_count() const { return shards_.size(); }
+
+  // run_job(input, output) processes one shard inside its worker process.
+  // Workers are forked from a single-threaded coordinator, so run_job must
+  // start any threads it needs itself.
+  template <typename ShardJob>
+  void run(ShardJob run_job) {
+    std::unordered_map<pid_t, std::size_t> running;
+    for (std::size_t shard{0}; shard < shards_.size(); shard++) {
+      running[launch(shard, run_job)] = shard;
+    }
+    while (!running.empty()) {
+      int status{0};
+      const pid_t pid{::waitpid(-1, &status, 0)};
+      if (pid < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        stop_workers(running);
+        throw CustomException("\tError waiting for shard processes.");
       }
-      case MessageType::encoded: {
-        return encoded_message_;
+      const auto worker{running.find(pid)};
+      if (worker == running.end()) {
+        continue;
       }
-      case MessageType::decoded: {
-        return decoded_message_;
+      const std::size_t shard{worker->second};
+      running.erase(worker);
+      if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+        continue;
       }
-      default: {
-        throw CustomException("\tInvalid message type.\n");
+      std::cerr << "Shard " << shard << " failed (" << describe_status(status)
+                << ")";
+      if (shards_[shard].attempt_count >= attempt_limit_) {
+        std::cerr << ", giving up.\n";
+        stop_workers(running);
+        throw CustomException("\tShard processing failed.");
       }
+      std::cerr << ", retrying.\n";
+      running[launch(shard, run_job)] = shard;
     }
+    merge_outputs();
   }
+};
+#endif
 
-  bool is_empty() const {
-    return encoded_message_.empty() && decoded_message_.empty();
-  }
+class CommandLine {
+ private:
+  std::vector<std::string> arguments_;
+  bool encode_flag_;
+  bool stream_flag_;
+  bool bench_flag_;
+  bool json_flag_;
+  bool archive_flag_;
+  bool packed_flag_;
+  bool import_flag_;
+  bool export_flag_;
+  bool serve_flag_;
+  bool loadgen_flag_;
+  int grid_size_;
+  int thread_count_;
+  int prefix_length_;
+  int min_time_ms_;
+  int cache_entries_;
+  int request_count_;
+  int connection_count_;
+  int message_length_;
+  int process_count_;
+  std::int64_t record_number_;
+  std::shared_ptr<PaddingSource> padding_source_;
+  std::string input_file_name_;
+  std::string output_file_name_;
+  std::string stats_file_name_;
+  std::string socket_path_;
 
-  void clear_message_buffer() {
-    raw_message_.clear();
-    encoded_message_.clear();
-    decoded_message_.clear();
-    std::cout << "\n\tAll stored messages have been wiped." << std::endl;
+  static constexpr std::streamsize io_buffer_size_{1 << 16};
+  static constexpr std::size_t archive_batch_size_{1 << 16};
+  static constexpr std::size_t archive_block_size_{1 << 20};
+
+  void print_usage(std::ostream &output) const {
+    output << "Usage: " << arguments_[0]
+           << " <encode|decode|import|export|serve|loadgen|bench> "
+              "[options]\n"
+           << "  --auto           Use the smallest grid for each message "
+              "(default)\n"
+           << "  --grid-size N    Encode every message into an NxN grid\n"
+           << "  --prefix N       Decode only the first N characters of each "
+              "message\n"
+           << "  --stream         Encode / decode a whole file as framed "
+              "grids\n"
+           << "  --archive        Encode to / decode from a binary archive "
+              "instead of lines\n"
+           << "  --packed         Store encoded grids in the archive at five "
+              "bits a letter\n"
+           << "  --record K       Decode / export only record K (from 0) of "
+              "an archive\n"
+           << "  --threads N      Number of worker threads (default: all "
+              "cores)\n"
+           << "  --processes N    Split a file of lines between N worker "
+              "processes, each with\n"
+           << "                   its share of the threads (requires -i and "
+              "-o)\n"
+           << "  --seed N         Derive padding from N and each message so "
+              "output is reproducible\n"
+           << "  --cache N        Cache N encodes per thread and encode repeated "
+              "lines once\n"
+           << "                   (requires --seed)\n"
+           << "  --json           Report benchmark results as JSON\n"
+           << "  --min-time MS    Minimum time per benchmark case (default: "
+              "100)\n"
+           << "  --stats FILE     Show live progress and write per-stage "
+              "statistics as JSON\n"
+           << "                   to FILE ('-' for stderr)\n"
+           << "  --socket PATH    Unix socket served by serve and used by "
+              "loadgen\n"
+           << "  --requests N     Requests sent by loadgen (default: 100000)\n"
+           << "  --connections N  Connections opened by loadgen (default: 4)\n"
+           << "  --length N       Message length used by loadgen (default: "
+              "64)\n"
+           << "  -i FILE          Read from FILE instead of stdin\n"
+           << "  -o FILE          Write to FILE instead of stdout\n"
+           << "  -h, --help       Show this message\n"
+           << "import converts encoded lines to an archive and export converts "
+              "an archive\n"
+           << "back to lines. serve runs a codec daemon on a Unix socket and "
+              "loadgen\n"
+           << "measures its throughput and latency.\n";
   }
-};
 
-class Driver {
- private:
-  std::shared_ptr<FileOperations> file_operations_;
-  std::shared_ptr<EncoderDecoder> encoder_decoder_;
-  std::shared_ptr<MessageBuffer> message_buffer_;
+  const std::string &next_argument(std::size_t &index) const {
+    if (++index >= arguments_.size()) {
+      throw CustomException(
+          ("Missing value for option '" + arguments_[index - 1] + "'.")
+              .c_str());
+    }
+    return arguments_[index];
+  }
 
-  std::string get_input_message() {
-    clear_input_buffer();
-    std::cout << "\nWARNING: This will clear all message buffers, leave blank "
-                 "to return.\n"
-              << "Enter the message: ";
-    std::string message;
-    std::getline(std::cin, message);
-    if (message.empty()) {
-      throw CustomException("\tNo message entered by user.");
+  static int parse_integer(const std::string &value, const std::string &name) {
+    std::size_t parsed_length{0};
+    int result{0};
+    try {
+      result = std::stoi(value, &parsed_length);
+    } catch (const std::exception &) {
+      parsed_length = 0;
     }
-    if (message.length() < 2) {
-      throw CustomException("\tMessage must be more than one character.");
+    if (parsed_length == 0 || parsed_length != value.length()) {
+      throw CustomException((name + " must be an integer.").c_str());
     }
-    return string_to_upper(message);
+    return result;
   }
 
-  void display_messages(const std::vector<std::string> &messages) {
-    int message_count{1};
-    for (const auto &message : messages) {
-      std::cout << "\tMessage " << message_count++ << ": " << message << '\n';
+  void parse_arguments() {
+    if (arguments_.size() < 2) {
+      throw CustomException("Missing command.");
+    }
+    if (arguments_[1] == "encode") {
+      encode_flag_ = true;
+    } else if (arguments_[1] == "bench") {
+      bench_flag_ = true;
+    } else if (arguments_[1] == "import") {
+      import_flag_ = true;
+    } else if (arguments_[1] == "export") {
+      export_flag_ = true;
+    } else if (arguments_[1] == "serve") {
+      serve_flag_ = true;
+    } else if (arguments_[1] == "loadgen") {
+      loadgen_flag_ = true;
+    } else if (arguments_[1] != "decode") {
+      throw CustomException(
+          ("Unknown command '" + arguments_[1] + "'.").c_str());
     }
-  }
 
-  void process_message_selection(const std::vector<std::string> &messages) {
-    std::cout << "\nWARNING: This will clear all message buffers (enter 0 to "
-                 "return, -1 encode all, -2 decode all).\n"
-              << "Select desired message to save to buffer: ";
-    int message_selection;
-    while (!(std::cin >> message_selection) || message_selection < 0 ||
-           message_selection > messages.size()) {
-      switch (message_selection) {
-        case (0): {
-          throw CustomException("\tReturning to main menu...");
+    bool is_auto_grid_size{false};
+    bool is_thread_count_set{false};
+    for (std::size_t index{2}; index < arguments_.size(); index++) {
+      const std::string &argument{arguments_[index]};
+      if (argument == "--auto") {
+        is_auto_grid_size = true;
+      } else if (argument == "--grid-size") {
+        grid_size_ = parse_integer(next_argument(index), "Grid size");
+      } else if (argument == "--threads") {
+        thread_count_ = parse_integer(next_argument(index), "Thread count");
+        if (thread_count_ < 1) {
+          throw CustomException("Thread count must be at least 1.");
         }
-        case (-1): {
-          encode_all_messages(messages);
-          return;
+        is_thread_count_set = true;
+      } else if (argument == "--processes") {
+        process_count_ = parse_integer(next_argument(index), "Process count");
+        if (process_count_ < 1) {
+          throw CustomException("Process count must be at least 1.");
         }
-        case (-2): {
-          decode_all_messages(messages);
-          return;
+      } else if (argument == "--prefix") {
+        prefix_length_ = parse_integer(next_argument(index), "Prefix length");
+        if (prefix_length_ < 1) {
+          throw CustomException("Prefix length must be at least 1.");
         }
-        default: {
-          std::cout << "\tInvalid input (enter 0 to return)...\n"
-                    << "Select a message between 1 and " << messages.size()
-                    << ": ";
-          clear_input_buffer();
+      } else if (argument == "--seed") {
+        const std::string &value{next_argument(index)};
+        std::size_t parsed_length{0};
+        try {
+          padding_source_ =
+              std::make_shared<SeededPadding>(std::stoull(value, &parsed_length));
+        } catch (const std::exception &) {
+          parsed_length = 0;
         }
-      }
-    }
-    // Valid message selection
-    message_buffer_->set_message(messages[message_selection - 1],
-                                 MessageType::raw);
-  }
-
-  void encode_all_messages(const std::vector<std::string> &messages) {
-    std::cout << "Encoding all messages to new file...\n";
-    constexpr bool is_auto_grid_size{true};
-    std::vector<std::string> encoded_messages;
-    for (const auto &message : messages) {
-      if (message.empty()) {
-        encoded_messages.push_back("");
-      } else {
-        // Try to add message to vector, catch exceptions to prevent further
-        // stack unwinding
+        if (parsed_length == 0 || parsed_length != value.length()) {
+          throw CustomException("Seed must be a non-negative integer.");
+        }
+      } else if (argument == "--cache") {
+        cache_entries_ = parse_integer(next_argument(index), "Cache size");
+        if (cache_entries_ < 1) {
+          throw CustomException("Cache size must be at least 1.");
+        }
+      } else if (argument == "--stream") {
+        stream_flag_ = true;
+      } else if (argument == "--archive") {
+        archive_flag_ = true;
+      } else if (argument == "--packed") {
+        packed_flag_ = true;
+      } else if (argument == "--record") {
+        const std::string &value{next_argument(index)};
+        std::size_t parsed_length{0};
         try {
-          encoded_messages.push_back(
-              encoder_decoder_->encode(message, is_auto_grid_size));
-        } catch (const CustomException &) {
-          // Add line for failures - we use 'FE:: / FD::' as it is ambiguous to
-          // users unfamiliar with the encryption
-          encoded_messages.push_back("FE::" + message);
+          record_number_ = std::stoll(value, &parsed_length);
+        } catch (const std::exception &) {
+          parsed_length = 0;
+        }
+        if (parsed_length == 0 || parsed_length != value.length() ||
+            record_number_ < 0) {
+          throw CustomException("Record number must be a non-negative "
+                                "integer.");
+        }
+      } else if (argument == "--json") {
+        json_flag_ = true;
+      } else if (argument == "--min-time") {
+        min_time_ms_ = parse_integer(next_argument(index), "Minimum time");
+        if (min_time_ms_ < 1) {
+          throw CustomException("Minimum time must be at least 1ms.");
+        }
+      } else if (argument == "--socket") {
+        socket_path_ = next_argument(index);
+      } else if (argument == "--requests") {
+        request_count_ = parse_integer(next_argument(index), "Request count");
+        if (request_count_ < 1) {
+          throw CustomException("Request count must be at least 1.");
+        }
+      } else if (argument == "--connections") {
+        connection_count_ =
+            parse_integer(next_argument(index), "Connection count");
+        if (connection_count_ < 1) {
+          throw CustomException("Connection count must be at least 1.");
+        }
+      } else if (argument == "--length") {
+        message_length_ = parse_integer(next_argument(index), "Message length");
+        if (message_length_ < 1 ||
+            message_length_ > decoded_length(global_max_size)) {
+          throw CustomException("Message length must be between 1 and 481.");
         }
+      } else if (argument == "--stats") {
+        stats_file_name_ = next_argument(index);
+      } else if (argument == "-i") {
+        input_file_name_ = next_argument(index);
+      } else if (argument == "-o") {
+        output_file_name_ = next_argument(index);
+      } else {
+        throw CustomException(
+            ("Unknown option '" + argument + "'.").c_str());
       }
     }
-    process_messages(encoded_messages);
-  }
 
-  void decode_all_messages(const std::vector<std::string> &messages) {
-    std::vector<std::string> decoded_messages;
-    std::cout << "Decoding all messages to new file.\n";
-    for (const auto &message : messages) {
-      if (message.empty()) {
-        decoded_messages.push_back("");
-      } else {
-        try {
-          decoded_messages.push_back(encoder_decoder_->decode(message));
-        } catch (const CustomException &) {
-          decoded_messages.push_back("FD::" + message);
-        }
+    if (is_auto_grid_size && grid_size_ != 0) {
+      throw CustomException("Options --auto and --grid-size are exclusive.");
+    }
+    if (grid_size_ != 0 && !encode_flag_ && !stream_flag_) {
+      throw CustomException("Grid size is only used when encoding.");
+    }
+    if (prefix_length_ != 0 && (encode_flag_ || stream_flag_)) {
+      throw CustomException("Prefix length is only used when decoding lines.");
+    }
+    if (cache_entries_ != 0 && (!encode_flag_ || stream_flag_)) {
+      throw CustomException("Option --cache is only used when encoding lines.");
+    }
+    if (cache_entries_ != 0 && !padding_source_->is_deterministic()) {
+      throw CustomException(
+          "Option --cache requires --seed, as random padding differs per "
+          "line.");
+    }
+    if ((import_flag_ || export_flag_) &&
+        (grid_size_ != 0 || prefix_length_ != 0 || cache_entries_ != 0 ||
+         stream_flag_ || archive_flag_)) {
+      throw CustomException("Commands import and export only accept "
+                            "--packed, --record, --stats, -i and -o.");
+    }
+    if (packed_flag_ && !import_flag_ && !(archive_flag_ && encode_flag_)) {
+      throw CustomException("Option --packed is only used when writing an "
+                            "archive.");
+    }
+    if (archive_flag_ && (stream_flag_ || bench_flag_)) {
+      throw CustomException("Option --archive is only used with encoded "
+                            "lines.");
+    }
+    if ((import_flag_ || (archive_flag_ && encode_flag_)) &&
+        output_file_name_.empty()) {
+      throw CustomException("Archives can only be written to a file (-o).");
+    }
+    if ((export_flag_ || (archive_flag_ && !encode_flag_)) &&
+        input_file_name_.empty()) {
+      throw CustomException("Archives can only be read from a file (-i).");
+    }
+    if (import_flag_ && input_file_name_.empty()) {
+      throw CustomException("Command import reads from a file (-i).");
+    }
+    if (record_number_ >= 0 && !export_flag_ &&
+        !(archive_flag_ && !encode_flag_)) {
+      throw CustomException("Option --record is only used when reading an "
+                            "archive.");
+    }
+    const bool is_daemon_command{serve_flag_ || loadgen_flag_};
+    if (is_daemon_command && socket_path_.empty()) {
+      throw CustomException("Commands serve and loadgen require --socket.");
+    }
+    if (!is_daemon_command && !socket_path_.empty()) {
+      throw CustomException("Option --socket is only used by serve and "
+                            "loadgen.");
+    }
+    if (is_daemon_command &&
+        (grid_size_ != 0 || prefix_length_ != 0 || cache_entries_ != 0 ||
+         stream_flag_ || archive_flag_ || record_number_ >= 0 ||
+         !input_file_name_.empty())) {
+      throw CustomException("Commands serve and loadgen only accept --socket, "
+                            "--threads, --seed, --stats, -o and the loadgen "
+                            "options.");
+    }
+    if (!loadgen_flag_ &&
+        (request_count_ != 0 || connection_count_ != 0 ||
+         message_length_ != 0)) {
+      throw CustomException("Options --requests, --connections and --length "
+                            "are only used by loadgen.");
+    }
+#if !defined(__linux__)
+    if (is_daemon_command) {
+      throw CustomException("Commands serve and loadgen require Linux.");
+    }
+#endif
+    if (process_count_ != 0) {
+      if (stream_flag_ || archive_flag_ || bench_flag_ || import_flag_ ||
+          export_flag_ || is_daemon_command || !stats_file_name_.empty()) {
+        throw CustomException("Option --processes is only used when "
+                              "encoding / decoding lines, without --stats.");
+      }
+      if (input_file_name_.empty() || output_file_name_.empty()) {
+        throw CustomException("Option --processes requires -i and -o.");
       }
+#if !(defined(__unix__) || defined(__APPLE__))
+      throw CustomException("Option --processes requires a POSIX system.");
+#endif
+      if (!is_thread_count_set) {
+        thread_count_ = std::max(thread_count_ / process_count_, 1);
+      }
+    }
+    if (json_flag_ && !bench_flag_) {
+      throw CustomException("Option --json is only used by bench.");
+    }
+    if (bench_flag_ && (grid_size_ != 0 || prefix_length_ != 0 ||
+                        stream_flag_ || !input_file_name_.empty() ||
+                        !stats_file_name_.empty())) {
+      throw CustomException("Benchmarks only accept --json, --min-time, "
+                            "--threads and -o.");
     }
-    process_messages(decoded_messages);
   }
 
-  void process_messages(const std::vector<std::string> &messages) {
-    messages.empty()
-        ? throw CustomException("Failed to process... Check contents of file.")
-        : file_operations_->save_to_file(messages);
+  void process_lines(std::istream &input, std::ostream &output) {
+    std::shared_ptr<BatchProcessor> batch_processor{
+        std::make_shared<BatchProcessor>(
+            static_cast<std::size_t>(thread_count_))};
+    batch_processor->set_padding_source(padding_source_);
+    batch_processor->set_result_cache_size(cache_entries_);
+    std::shared_ptr<OutputFormat> output_format{
+        archive_flag_ ? std::static_pointer_cast<OutputFormat>(
+                            std::make_shared<ArchiveWriter>(packed_flag_))
+                      : std::make_shared<TextFormat>()};
+    LinePipeline line_pipeline{batch_processor, output_format};
+    line_pipeline.run(input, output, encode_flag_, grid_size_,
+                      prefix_length_);
   }
 
- public:
-  Driver()
-      : file_operations_{std::make_shared<FileOperations>()},
-        encoder_decoder_{std::make_shared<EncoderDecoder>()},
-        message_buffer_{std::make_shared<MessageBuffer>()} {}
+  // Splits the input file between process_count_ worker processes, each
+  // running the usual line pipeline on its own shard.
+  void process_shards() {
+#if defined(__unix__) || defined(__APPLE__)
+    ShardCoordinator shard_coordinator{
+        input_file_name_, output_file_name_,
+        static_cast<std::size_t>(process_count_)};
+    shard_coordinator.run([this](std::istream &input, std::ostream &output) {
+      process_lines(input, output);
+    });
+#endif
+  }
 
-  void get_message_from_user() {
-    message_buffer_->set_message(get_input_message(), MessageType::raw);
+  static void write_block(std::ostream &output, std::string &block) {
+    {
+      StageTimer timer{Stage::save, block.length()};
+      output.write(block.data(), block.length());
+    }
+    if (!output) {
+      throw CustomException("\tError writing output.");
+    }
+    block.clear();
   }
 
-  void get_messages_from_file() {
-    const std::vector<std::string> messages{file_operations_->load_from_file()};
-    display_messages(messages);
-    process_message_selection(messages);
+  void import_lines(std::ostream &output) {
+    MessageFile message_file{input_file_name_};
+    ArchiveWriter archive_writer{packed_flag_};
+    archive_writer.begin(output);
+    std::string block;
+    for (const auto &message : message_file.messages()) {
+      archive_writer.append(message, block);
+      if (block.length() >= archive_block_size_) {
+        write_block(output, block);
+      }
+    }
+    write_block(output, block);
+    archive_writer.finish(output);
   }
 
-  void encode_user_message() {
-    if (!message_buffer_->get_message(MessageType::decoded).empty()) {
-      std::cout << "\tFound decoded message in buffer: "
-                << message_buffer_->get_message(MessageType::decoded) << '\n';
-      if (get_user_choice("Would you like to encode this? (y/n): ") == 'Y') {
-        message_buffer_->set_message(
-            encoder_decoder_->encode(
-                message_buffer_->get_message(MessageType::decoded)),
-            MessageType::encoded);
+  // Packed records are decoded straight from their packed form here, and
+  // only unpacked when exported as stored.
+  void append_packed_record(const ArchiveRecord &record,
+                            const bool decode_flag, std::string &block) {
+    const std::size_t block_length{block.length()};
+    if (decode_flag) {
+      StageTimer timer{Stage::decode, record.payload.length()};
+      block.resize(block_length + decoded_length(record.grid_size));
+      const CodecResult<std::size_t> decoded{DiamondCodec::try_decode_packed(
+          record.payload, record.grid_size, &block[block_length],
+          block.length() - block_length)};
+      if (decoded) {
+        if (prefix_length_ != 0) {
+          block.resize(block_length +
+                       std::min(decoded.value(),
+                                static_cast<std::size_t>(prefix_length_)));
+        }
         return;
       }
+      global_statistics.record_failure(Stage::decode);
+      block.resize(block_length);
+      block += ArchiveLayout::status_prefix(RecordStatus::decode_failed);
     }
+    const std::size_t cell_count{static_cast<std::size_t>(record.grid_size) *
+                                 record.grid_size};
+    const std::size_t text_length{block.length()};
+    block.resize(text_length + cell_count);
+    unpack_letters(record.payload.data(), cell_count, &block[text_length]);
+  }
 
-    if (message_buffer_->get_message(MessageType::raw).empty()) {
-      std::cout
-          << "\tNo raw messages in buffer. Getting new message from user..."
-          << std::endl;
-      get_message_from_user();
+  // Writes the records of an archive as lines, decoded or as stored. Records
+  // are fetched a batch at a time, so only the requested ones are read.
+  void export_lines(std::ostream &output, const bool decode_flag) {
+    ArchiveReader archive_reader{input_file_name_};
+    std::uint64_t first{0};
+    std::uint64_t last{archive_reader.record_count()};
+    if (record_number_ >= 0) {
+      first = static_cast<std::uint64_t>(record_number_);
+      archive_reader.record(first);
+      last = first + 1;
     }
-    message_buffer_->set_message(
-        encoder_decoder_->encode(
-            message_buffer_->get_message(MessageType::raw)),
-        MessageType::encoded);
-  }
 
-  void decode_user_message() {
-    if (!message_buffer_->get_message(MessageType::encoded).empty()) {
-      std::cout << "\tFound encoded message in buffer: "
-                << message_buffer_->get_message(MessageType::encoded) << '\n';
-      if (get_user_choice("Would you like to decode this? (y/n): ") == 'Y') {
-        message_buffer_->set_message(
-            encoder_decoder_->decode(
-                message_buffer_->get_message(MessageType::encoded)),
-            MessageType::decoded);
-        return;
-      }
+    std::shared_ptr<BatchProcessor> batch_processor;
+    if (decode_flag) {
+      batch_processor = std::make_shared<BatchProcessor>(
+          static_cast<std::size_t>(thread_count_));
     }
+    std::vector<ArchiveRecord> records;
+    std::vector<std::string_view> messages;
+    std::string block;
+    for (std::uint64_t begin{first}; begin < last;
+         begin += archive_batch_size_) {
+      const std::uint64_t end{
+          std::min<std::uint64_t>(last, begin + archive_batch_size_)};
+      records.clear();
+      messages.clear();
+      for (std::uint64_t index{begin}; index < end; index++) {
+        records.push_back(archive_reader.record(index));
+        if (decode_flag && records.back().status == RecordStatus::ok &&
+            !records.back().is_packed) {
+          messages.push_back(records.back().payload);
+        }
+      }
+      const std::vector<std::string> results{
+          decode_flag ? batch_processor->decode_all(messages, prefix_length_)
+                      : std::vector<std::string>{}};
 
-    if (message_buffer_->get_message(MessageType::raw).empty()) {
-      std::cout
-          << "\tNo raw messages in buffer. Getting new message from user..."
-          << std::endl;
-      get_message_from_user();
+      std::size_t result_index{0};
+      for (const auto &record : records) {
+        if (record.is_packed) {
+          append_packed_record(record, decode_flag, block);
+        } else if (decode_flag && record.status == RecordStatus::ok) {
+          block += results[result_index++];
+        } else {
+          block += ArchiveLayout::status_prefix(record.status);
+          block += record.payload;
+        }
+        block += '\n';
+      }
+      write_block(output, block);
     }
-    message_buffer_->set_message(
-        encoder_decoder_->decode(
-            message_buffer_->get_message(MessageType::raw)),
-        MessageType::decoded);
   }
 
-  void save_messages_to_file() {
-    if (message_buffer_->is_empty()) {
-      throw CustomException(
-          "Buffer is empty. No encoded / decoded messages to save.");
+  // Runs the codec daemon until it is signalled to stop, or the load
+  // generator against it. Returns false if any loadgen request failed.
+  bool run_daemon_command(std::ostream &output) {
+#if defined(__linux__)
+    if (serve_flag_) {
+      CodecServer codec_server{socket_path_,
+                               static_cast<std::size_t>(thread_count_),
+                               padding_source_};
+      codec_server.run(std::cerr);
+      return true;
     }
-    file_operations_->save_to_file(
-        {message_buffer_->get_message(MessageType::encoded),
-         message_buffer_->get_message(MessageType::decoded)});
-    message_buffer_->clear_message_buffer();
+    LoadGenerator load_generator{
+        socket_path_,
+        static_cast<std::size_t>(connection_count_ != 0 ? connection_count_
+                                                        : 4),
+        static_cast<std::uintmax_t>(request_count_ != 0 ? request_count_
+                                                        : 100000),
+        static_cast<std::size_t>(message_length_ != 0 ? message_length_
+                                                      : 64)};
+    return load_generator.run(output);
+#else
+    static_cast<void>(output);
+    return false;
+#endif
   }
-};
 
-class UserInterface {
- private:
-  int get_menu_option() {
-    std::cout << '\n'
-              << "*****************************************************\n"
-              << "* 1, Enter a message                                *\n"
-              << "* 2, Load a message from a file                     *\n"
-              << "* 3, Encode a message                               *\n"
-              << "* 4, Decode a message                               *\n"
-              << "* 5, Save the message & decoded message to a file.  *\n"
-              << "* 6, Quit                                           *\n"
-              << "*****************************************************\n"
-              << "Select option: ";
-    int menu_option;
-    while (!(std::cin >> menu_option) || menu_option < 1 || menu_option > 6) {
-      std::cout
-          << "Invalid input. Please enter a menu option between 1 and 6: ";
-      clear_input_buffer();
+  void run_benchmark(std::ostream &output) {
+    Benchmark benchmark{std::chrono::milliseconds(min_time_ms_),
+                        thread_count_};
+    benchmark.run();
+    json_flag_ ? benchmark.report_json(output) : benchmark.report(output);
+  }
+
+  void process_stream(std::istream &input, std::ostream &output) {
+    StreamCodec stream_codec{
+        grid_size_ != 0 ? grid_size_ : stream_default_size, padding_source_};
+    StageTimer timer{encode_flag_ ? Stage::encode : Stage::decode};
+    timer.set_bytes(encode_flag_ ? stream_codec.encode_stream(input, output)
+                                 : stream_codec.decode_stream(input, output));
+  }
+
+  bool write_statistics() const {
+    std::cerr << "Statistics:\n" << global_statistics.summary();
+    if (stats_file_name_ == "-") {
+      global_statistics.report_json(std::cerr);
+      return true;
     }
-    return menu_option;
+    std::ofstream stats_file(stats_file_name_);
+    if (!stats_file.is_open()) {
+      std::cerr << "Error opening statistics file '" << stats_file_name_
+                << "'.\n";
+      return false;
+    }
+    global_statistics.report_json(stats_file);
+    return static_cast<bool>(stats_file);
   }
 
  public:
-  void run_coder() {
-    std::unique_ptr<Driver> driver_{std::make_unique<Driver>()};
+  CommandLine(int argc, char *argv[])
+      : arguments_(argv, argv + argc),
+        encode_flag_{false},
+        stream_flag_{false},
+        bench_flag_{false},
+        json_flag_{false},
+        archive_flag_{false},
+        packed_flag_{false},
+        import_flag_{false},
+        export_flag_{false},
+        serve_flag_{false},
+        loadgen_flag_{false},
+        grid_size_{0},
+        thread_count_{static_cast<int>(
+            std::max(std::thread::hardware_concurrency(), 1u))},
+        prefix_length_{0},
+        min_time_ms_{100},
+        cache_entries_{0},
+        request_count_{0},
+        connection_count_{0},
+        message_length_{0},
+        process_count_{0},
+        record_number_{-1},
+        padding_source_{std::make_shared<FastPadding>()} {}
 
-    constexpr int num_options{6};
-    using OptionFunction = void (Driver::*)();
-    OptionFunction options[num_options] = {
-        &Driver::get_message_from_user, &Driver::get_messages_from_file,
-        &Driver::encode_user_message, &Driver::decode_user_message,
-        &Driver::save_messages_to_file};
+  int run() {
+    if (arguments_.size() > 1 &&
+        (arguments_[1] == "-h" || arguments_[1] == "--help")) {
+      print_usage(std::cout);
+      return EXIT_SUCCESS;
+    }
+    try {
+      parse_arguments();
+    } catch (const CustomException &e) {
+      std::cerr << e.what() << '\n';
+      print_usage(std::cerr);
+      return EXIT_FAILURE;
+    }
 
-    // Loop until user enters option '6'
-    int option{get_menu_option()};
-    while (option != num_options) {
-      try {
-        if (option > 0 && option <= num_options) {
-          (driver_.get()->*options[option - 1])();
-        } else {
-          std::cerr << "\tInvalid option.\n";
-        }
-      } catch (const CustomException &e) {
-        std::cerr << e.what() << '\n';
+    std::ios::sync_with_stdio(false);
+    std::cin.tie(nullptr);
+    std::vector<char> input_buffer(io_buffer_size_);
+    std::vector<char> output_buffer(io_buffer_size_);
+    const auto open_mode{
+        stream_flag_ || archive_flag_ || import_flag_ || export_flag_
+            ? std::ios::binary
+            : std::ios::openmode{}};
+
+    std::ifstream input_file;
+    std::ofstream output_file;
+    if (!input_file_name_.empty()) {
+      input_file.rdbuf()->pubsetbuf(input_buffer.data(), io_buffer_size_);
+      input_file.open(input_file_name_, std::ios::in | open_mode);
+      if (!input_file.is_open()) {
+        std::cerr << "Error opening input file '" << input_file_name_
+                  << "'.\n";
+        return EXIT_FAILURE;
       }
-      option = get_menu_option();
     }
-    std::cout << "\tExiting program..." << std::endl;
+    if (!output_file_name_.empty()) {
+      output_file.rdbuf()->pubsetbuf(output_buffer.data(), io_buffer_size_);
+      output_file.open(output_file_name_, std::ios::out | open_mode);
+      if (!output_file.is_open()) {
+        std::cerr << "Error opening output file '" << output_file_name_
+                  << "'.\n";
+        return EXIT_FAILURE;
+      }
+    }
+    std::istream &input{input_file.is_open() ? input_file : std::cin};
+    std::ostream &output{output_file.is_open() ? output_file : std::cout};
+
+    std::unique_ptr<ProgressReporter> progress_reporter;
+    if (!stats_file_name_.empty()) {
+      global_statistics.enable();
+      progress_reporter = std::make_unique<ProgressReporter>();
+    }
+    bool is_success{true};
+    try {
+      if (bench_flag_) {
+        run_benchmark(output);
+      } else if (stream_flag_) {
+        process_stream(input, output);
+      } else if (serve_flag_ || loadgen_flag_) {
+        is_success = run_daemon_command(output);
+      } else if (import_flag_) {
+        import_lines(output);
+      } else if (export_flag_ || (archive_flag_ && !encode_flag_)) {
+        export_lines(output, !export_flag_);
+      } else if (process_count_ != 0) {
+        process_shards();
+      } else {
+        process_lines(input, output);
+      }
+      output.flush();
+      is_success = is_success && static_cast<bool>(output);
+    } catch (const CustomException &e) {
+      std::cerr << e.what() << '\n';
+      is_success = false;
+    }
+    if (progress_reporter) {
+      progress_reporter->stop();
+      is_success = write_statistics() && is_success;
+    }
+    return is_success ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 };
 
-int main() {
+// Tests include this file with ENCRYPT_MESSAGES_NO_MAIN defined to reach
+// its classes directly.
+#if !defined(ENCRYPT_MESSAGES_NO_MAIN)
+int main(int argc, char *argv[]) {
+  FileOperations::set_executable_name(argv[0]);
+  if (const char *shard_size{std::getenv("ENCRYPT_MESSAGES_SHARD_SIZE")}) {
+    FileOperations::set_shard_size(std::strtoull(shard_size, nullptr, 10));
+  }
+  if (argc > 1) {
+    std::unique_ptr<CommandLine> command_line{
+        std::make_unique<CommandLine>(argc, argv)};
+    return command_line->run();
+  }
+
   std::unique_ptr<UserInterface> user_interface{
       std::make_unique<UserInterface>()};
   user_interface->run_coder();
   return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,287 @@
+// Object Oriented Programming - Secret Message Encoder & Decoder
+// Binary archive and packed record tests.
+
+#define ENCRYPT_MESSAGES_NO_MAIN
+#include "../src/encrypt_messages.cpp"
+
+namespace {
+
+int failure_count{0};
+
+void check(bool condition, const char *description) {
+  if (!condition) {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failure_count++;
+  }
+}
+
+const std::string test_directory{"/tmp/archive_test_" +
+                                 std::to_string(::getpid())};
+
+std::string test_path(const std::string &file_name) {
+  return test_directory + '/' + file_name;
+}
+
+std::string read_file(const std::string &file_name) {
+  std::ifstream file{file_name, std::ios::binary};
+  return std::string{std::istreambuf_iterator<char>{file},
+                     std::istreambuf_iterator<char>{}};
+}
+
+void write_file(const std::string &file_name, const std::string &contents) {
+  std::ofstream file{file_name, std::ios::binary};
+  file << contents;
+}
+
+// Runs the command line in this process, returning its exit status.
+int run_command(std::vector<std::string> arguments) {
+  arguments.insert(arguments.begin(), "encrypt_messages");
+  std::vector<char *> argv;
+  for (auto &argument : arguments) {
+    argv.push_back(&argument[0]);
+  }
+  CommandLine command_line{static_cast<int>(argv.size()), argv.data()};
+  return command_line.run();
+}
+
+// True if opening the archive, or reading record, throws.
+bool is_rejected(const std::string &file_name, std::uint64_t record = 0) {
+  try {
+    ArchiveReader reader{file_name};
+    reader.record(record);
+  } catch (const CustomException &) {
+    return true;
+  }
+  return false;
+}
+
+// Encoded lines, including failures of both kinds, survive import and
+// export unchanged, and --record finds one record without the others.
+void test_round_trip() {
+  const std::string encoded{test_path("encoded.txt")};
+  write_file(test_path("messages.txt"),
+             "HELLO WORLD\nA\nSECRET MESSAGE\nMEET AT NOON\n");
+  check(run_command({"encode", "--seed", "18", "-i", test_path("messages.txt"),
+                     "-o", encoded}) == 0,
+        "encode messages");
+  std::string lines{read_file(encoded)};
+  lines += "FD::NOTAGRID\n";
+  write_file(encoded, lines);
+
+  check(run_command({"import", "-i", encoded, "-o", test_path("lines.dma")}) ==
+            0,
+        "import lines");
+  check(run_command({"export", "-i", test_path("lines.dma"), "-o",
+                     test_path("exported.txt")}) == 0,
+        "export archive");
+  check(read_file(test_path("exported.txt")) == lines,
+        "export gives back the imported lines");
+
+  ArchiveReader reader{test_path("lines.dma")};
+  check(reader.record_count() == 5, "archive holds every line");
+  check(reader.record(1).status == RecordStatus::encode_failed &&
+            reader.record(1).payload == "A",
+        "encode failure is kept as a status");
+  check(reader.record(4).status == RecordStatus::decode_failed &&
+            reader.record(4).grid_size == 0,
+        "decode failure is kept as a status");
+
+  std::istringstream line_stream{lines};
+  std::vector<std::string> line_list;
+  for (std::string line; std::getline(line_stream, line);) {
+    line_list.push_back(line);
+  }
+  for (std::size_t record{0}; record < line_list.size(); record++) {
+    const std::string record_file{test_path("record.txt")};
+    check(run_command({"export", "--record", std::to_string(record), "-i",
+                       test_path("lines.dma"), "-o", record_file}) == 0 &&
+              read_file(record_file) == line_list[record] + '\n',
+          "--record exports exactly that record");
+  }
+  check(run_command({"export", "--record", "5", "-i", test_path("lines.dma"),
+                     "-o", test_path("record.txt")}) != 0,
+        "--record past the last record fails");
+}
+
+// A truncated index, a record count that disagrees with it and records
+// pointing outside the record area are all reported as damage.
+void test_damage() {
+  const std::string archive{read_file(test_path("lines.dma"))};
+  const std::uint64_t index_offset{get_little_endian(archive.data() + 16, 8)};
+  const std::string damaged{test_path("damaged.dma")};
+
+  write_file(damaged, archive.substr(0, archive.length() - 1));
+  check(is_rejected(damaged), "truncated index is rejected");
+  write_file(damaged, archive.substr(0, archive.length() -
+                                            ArchiveLayout::entry_size));
+  check(is_rejected(damaged), "missing index entry is rejected");
+  write_file(damaged, archive.substr(0, 12));
+  check(is_rejected(damaged), "truncated header is rejected");
+
+  std::string bad{archive};
+  put_little_endian(&bad[16], archive.length() + 1, 8);
+  write_file(damaged, bad);
+  check(is_rejected(damaged), "index offset past the end is rejected");
+
+  bad = archive;
+  put_little_endian(&bad[index_offset], 4, 8);
+  write_file(damaged, bad);
+  check(is_rejected(damaged, 0), "record offset inside the header is rejected");
+
+  bad = archive;
+  put_little_endian(&bad[index_offset], index_offset + 1, 8);
+  write_file(damaged, bad);
+  check(is_rejected(damaged, 0),
+        "record offset inside the index is rejected");
+
+  bad = archive;
+  put_little_endian(&bad[index_offset + 8], index_offset, 4);
+  write_file(damaged, bad);
+  check(is_rejected(damaged, 0), "record running into the index is rejected");
+
+  bad = archive;
+  put_little_endian(&bad[index_offset + 14], 3, 1);
+  write_file(damaged, bad);
+  check(is_rejected(damaged, 0), "unknown status is rejected");
+
+  bad = archive;
+  bad[0] = 'X';
+  write_file(damaged, bad);
+  check(is_rejected(damaged), "wrong magic is rejected");
+}
+
+// Packs and unpacks letters with the scalar kernels and, where the CPU has
+// BMI2, the BMI2 kernels. Returns false on any difference between the two
+// or from the original, or a write past packed_size.
+bool is_packing_consistent(const std::string &text) {
+  constexpr char sentinel{'\x5A'};
+  const std::size_t size{packed_size(text.length())};
+  std::string scalar_packed(size + 8, sentinel);
+  pack_scalar(text.data(), text.length(), &scalar_packed[0]);
+  std::string scalar_text(text.length() + 8, sentinel);
+  unpack_scalar(scalar_packed.data(), text.length(), &scalar_text[0]);
+  if (scalar_packed.substr(size) != std::string(8, sentinel) ||
+      scalar_text != text + std::string(8, sentinel)) {
+    return false;
+  }
+#if defined(__x86_64__) || defined(_M_X64)
+  if (cpu_supports_bmi2()) {
+    std::string bmi2_packed(size + 8, sentinel);
+    pack_bmi2(text.data(), text.length(), &bmi2_packed[0]);
+    std::string bmi2_text(text.length() + 8, sentinel);
+    unpack_bmi2(scalar_packed.data(), text.length(), &bmi2_text[0]);
+    if (bmi2_packed != scalar_packed || bmi2_text != scalar_text) {
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
+std::string random_letters(Xoshiro256 &generator, std::size_t length) {
+  std::string letters(length, '\0');
+  generator.fill_letters(&letters[0], length);
+  return letters;
+}
+
+// Both kernel paths give the same bytes for lengths 0 to 17 and for every
+// grid up to 31x31, and a packed grid decodes like the plain one.
+void test_packing() {
+  Xoshiro256 generator{23};
+  bool is_consistent{true};
+  for (std::size_t length{0}; length <= 17; length++) {
+    is_consistent &= is_packing_consistent(random_letters(generator, length));
+    is_consistent &= is_packing_consistent(std::string(length, 'A'));
+    is_consistent &= is_packing_consistent(std::string(length, 'Z'));
+  }
+  check(is_consistent, "kernels agree for lengths 0 to 17");
+
+  is_consistent = true;
+  bool is_decode_equal{true};
+  DiamondCodec codec;
+  for (int grid_size{3}; grid_size <= global_max_size; grid_size += 2) {
+    const std::string grid{random_letters(generator, square(grid_size))};
+    is_consistent &= is_packing_consistent(grid);
+    std::string packed(packed_size(grid.length()), '\0');
+    pack_letters(grid, &packed[0]);
+    std::string decoded(decoded_length(grid_size), '\0');
+    std::string packed_decoded(decoded.length(), '\0');
+    const CodecResult<std::size_t> plain_result{
+        codec.try_decode(grid, &decoded[0], decoded.length())};
+    const CodecResult<std::size_t> packed_result{DiamondCodec::try_decode_packed(
+        packed, grid_size, &packed_decoded[0], packed_decoded.length())};
+    is_decode_equal &= plain_result && packed_result &&
+                       plain_result.value() == packed_result.value() &&
+                       decoded == packed_decoded;
+  }
+  check(is_consistent, "kernels agree for every grid up to 31x31");
+  check(is_decode_equal, "try_decode_packed matches try_decode");
+  check(!DiamondCodec::try_decode_packed(std::string(5, '\0'), 3, nullptr, 0) &&
+            DiamondCodec::try_decode_packed(std::string(5, '\0'), 3, nullptr, 0)
+                    .error() == CodecError::packed_size_mismatch,
+        "packed grid of the wrong length is rejected");
+}
+
+// A packed archive exports like the plain one, and a damaged flag or
+// length byte in a packed record's index entry is rejected.
+void test_packed_archive() {
+  const std::string encoded{test_path("encoded.txt")};
+  const std::string packed_archive{test_path("packed.dma")};
+  check(run_command({"import", "--packed", "-i", encoded, "-o",
+                     packed_archive}) == 0,
+        "import packed");
+  check(run_command({"export", "-i", packed_archive, "-o",
+                     test_path("packed.txt")}) == 0 &&
+            read_file(test_path("packed.txt")) == read_file(encoded),
+        "packed archive exports the imported lines");
+
+  const std::string archive{read_file(packed_archive)};
+  const std::uint64_t index_offset{get_little_endian(archive.data() + 16, 8)};
+  ArchiveReader reader{packed_archive};
+  check(reader.record(0).is_packed && !reader.record(1).is_packed,
+        "grids are packed and failures are not");
+  const std::string damaged{test_path("damaged.dma")};
+  const auto entry{[&](std::uint64_t record, std::size_t field) {
+    return index_offset + record * ArchiveLayout::entry_size + field;
+  }};
+
+  std::string bad{archive};
+  bad[entry(0, 15)] = '\x02';
+  write_file(damaged, bad);
+  check(is_rejected(damaged, 0), "unknown flag bit is rejected");
+
+  bad = archive;
+  bad[entry(1, 15)] = ArchiveLayout::packed_flag;
+  write_file(damaged, bad);
+  check(is_rejected(damaged, 1), "packed flag on a failed record is rejected");
+
+  bad = archive;
+  bad[entry(0, 8)] = static_cast<char>(bad[entry(0, 8)] - 1);
+  write_file(damaged, bad);
+  check(is_rejected(damaged, 0), "wrong packed length is rejected");
+
+  // An unpacked grid flagged as packed has the wrong length for its grid.
+  const std::string plain{read_file(test_path("lines.dma"))};
+  const std::uint64_t plain_index_offset{
+      get_little_endian(plain.data() + 16, 8)};
+  bad = plain;
+  bad[plain_index_offset + 15] = ArchiveLayout::packed_flag;
+  write_file(damaged, bad);
+  check(is_rejected(damaged, 0), "packed flag on a plain grid is rejected");
+}
+
+}  // namespace
+
+int main() {
+  std::filesystem::create_directories(test_directory);
+  test_round_trip();
+  test_damage();
+  test_packing();
+  test_packed_archive();
+  std::filesystem::remove_all(test_directory);
+
+  if (failure_count == 0) {
+    std::printf("archive_test: all tests passed\n");
+  }
+  return failure_count == 0 ? 0 : 1;
+}
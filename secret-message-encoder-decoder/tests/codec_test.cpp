@@ -0,0 +1,212 @@
+// Object Oriented Programming - Secret Message Encoder & Decoder
+// Codec library tests.
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/diamond_codec.h"
+
+namespace {
+
+int failure_count{0};
+
+void check(bool condition, const char *description) {
+  if (!condition) {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failure_count++;
+  }
+}
+
+// A grid larger than 31x31 is reported as too large, with the maximum in
+// its message, rather than as too small for the message.
+void test_grid_too_large() {
+  const CodecResult<int> result{DiamondCodec::check_encode(5, 33)};
+  check(!result, "33x33 grid is rejected");
+  check(result.error() == CodecError::grid_too_large,
+        "33x33 grid is reported as too large");
+  check(std::strstr(codec_error_message(result.error()), "31") != nullptr,
+        "too large message gives the maximum grid size");
+  check(DiamondCodec::check_encode(5, 31).value() == 31,
+        "31x31 grid is accepted");
+  check(DiamondCodec::check_encode(30, 5).error() == CodecError::grid_too_small,
+        "5x5 grid is too small for 30 characters");
+}
+
+// The blocked path is only used for grids of blocked_min_size and up, where
+// a wrong cell would silently corrupt stream frames. Its segments must cover
+// exactly the cells of build_path in message order, each segment inside one
+// tile, with the tiles in row-major order.
+bool is_blocked_path_valid(int grid_size) {
+  const std::vector<int> path{PermutationCache::build_path(grid_size)};
+  const std::vector<PathSegment> segments{
+      PermutationCache::build_blocked_path(grid_size)};
+  const int tiles_per_side{(grid_size + path_tile_size - 1) / path_tile_size};
+  std::vector<int> blocked_path(path.size(), -1);
+  int previous_tile{0};
+  for (const PathSegment &segment : segments) {
+    int tile{-1};
+    for (std::uint32_t step{0}; step < segment.length; step++) {
+      const std::size_t index{segment.message_index + step};
+      const std::int64_t cell{static_cast<std::int64_t>(segment.cell) +
+                              static_cast<std::int64_t>(step) * segment.stride};
+      if (index >= blocked_path.size() || blocked_path[index] != -1 ||
+          cell < 0 || cell >= square(grid_size)) {
+        return false;
+      }
+      blocked_path[index] = static_cast<int>(cell);
+      const int row{static_cast<int>(cell / grid_size)};
+      const int col{static_cast<int>(cell % grid_size)};
+      const int cell_tile{(row / path_tile_size) * tiles_per_side +
+                          col / path_tile_size};
+      if (tile != -1 && cell_tile != tile) {
+        return false;
+      }
+      tile = cell_tile;
+    }
+    if (tile < previous_tile) {
+      return false;
+    }
+    previous_tile = tile;
+  }
+  return blocked_path == path;
+}
+
+void test_blocked_path() {
+  bool is_valid{true};
+  for (int grid_size{3}; grid_size <= 41; grid_size += 2) {
+    is_valid &= is_blocked_path_valid(grid_size);
+  }
+  check(is_valid, "blocked path matches build_path up to 41x41");
+  for (const int grid_size : {63, 65, 127, 129, 509, blocked_min_size, 513,
+                              639, 1023, 1025, 1101}) {
+    if (!is_blocked_path_valid(grid_size)) {
+      std::fprintf(stderr, "blocked path differs at %dx%d\n", grid_size,
+                   grid_size);
+      is_valid = false;
+    }
+  }
+  check(is_valid, "blocked path matches build_path up to 1101x1101");
+}
+
+std::string random_text(std::mt19937 &generator, std::size_t length) {
+  std::string text(length, ' ');
+  for (char &ch : text) {
+    // About one character in eight is a space, which stays padding.
+    const unsigned letter{static_cast<unsigned>(generator() % 208)};
+    ch = letter < 182 ? static_cast<char>('A' + letter % 26) : ' ';
+  }
+  return text;
+}
+
+// Random assign / replace / insert / erase / append sequences, checked after
+// every edit against a model: a fresh grid whenever the smallest grid
+// changes, equal to DiamondCodec::encode, and otherwise that grid's padding
+// with the message written over its diamond cells.
+void test_incremental_edits() {
+  constexpr std::uint64_t seed{25};
+  constexpr int edit_count{200000};
+  const std::size_t max_length{
+      static_cast<std::size_t>(decoded_length(global_max_size))};
+  std::mt19937 generator{seed};
+  IncrementalEncoder encoder{std::make_shared<SeededPadding>(seed)};
+  DiamondCodec codec{std::make_shared<SeededPadding>(seed)};
+  std::string message;
+  std::string padding;
+  int grid_size{0};
+  std::size_t full_encode_count{0};
+  int mismatch_count{0};
+
+  for (int edit{0}; edit < edit_count && mismatch_count == 0; edit++) {
+    const std::size_t length{message.length()};
+    const std::size_t index{generator() % (length + 1)};
+    const std::size_t room{max_length - length};
+    switch (generator() % 5) {
+      case 0: {
+        // Mostly small changes, so most assigns keep their grid.
+        const std::string text{
+            generator() % 4 == 0
+                ? random_text(generator, generator() % (max_length + 1))
+                : message.substr(0, index) +
+                      random_text(generator,
+                                  std::min<std::size_t>(generator() % 4,
+                                                        max_length - index))};
+        encoder.assign(text);
+        message = text;
+        break;
+      }
+      case 1: {
+        const std::string text{random_text(
+            generator, std::min<std::size_t>(generator() % 8,
+                                             max_length - index))};
+        encoder.replace(index, text);
+        message.replace(index, std::min(text.length(), length - index), text);
+        break;
+      }
+      case 2: {
+        const std::string text{random_text(
+            generator, std::min<std::size_t>(generator() % 8, room))};
+        encoder.insert(index, text);
+        message.insert(index, text);
+        break;
+      }
+      case 3: {
+        const std::size_t count{
+            std::min<std::size_t>(generator() % 8, length - index)};
+        encoder.erase(index, count);
+        message.erase(index, count);
+        break;
+      }
+      default: {
+        const std::string text{random_text(
+            generator, std::min<std::size_t>(generator() % 8, room))};
+        encoder.append(text);
+        message += text;
+        break;
+      }
+    }
+
+    const int expected_grid_size{
+        std::max(DiamondCodec::min_grid_size(message.length()), 3)};
+    const std::size_t cell_count{
+        static_cast<std::size_t>(square(expected_grid_size))};
+    std::string expected(cell_count, '\0');
+    if (expected_grid_size != grid_size) {
+      grid_size = expected_grid_size;
+      full_encode_count++;
+      padding.resize(cell_count);
+      SeededPadding{seed}.fill(&padding[0], cell_count,
+                               hash_message(message, grid_size));
+      codec.encode(message, &expected[0], cell_count, grid_size);
+    } else {
+      expected = padding;
+      for (std::size_t index{0}; index < message.length(); index++) {
+        if (message[index] != ' ') {
+          expected[diamond_cell(grid_size, static_cast<int>(index))] =
+              message[index];
+        }
+      }
+    }
+    if (encoder.message() != message || encoder.grid_size() != grid_size ||
+        encoder.encoded_message() != expected ||
+        encoder.full_encode_count() != full_encode_count) {
+      mismatch_count++;
+    }
+  }
+  check(mismatch_count == 0, "incremental edits match the model");
+}
+
+}  // namespace
+
+int main() {
+  test_grid_too_large();
+  test_blocked_path();
+  test_incremental_edits();
+
+  if (failure_count == 0) {
+    std::printf("codec_test: all tests passed\n");
+  }
+  return failure_count == 0 ? 0 : 1;
+}
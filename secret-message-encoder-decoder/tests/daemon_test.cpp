@@ -0,0 +1,265 @@
+// Object Oriented Programming - Secret Message Encoder & Decoder
+// Codec daemon tests. Run with the path of a built encrypt_messages:
+//   daemon_test ./encrypt_messages
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+int failure_count{0};
+
+void check(bool condition, const char *description) {
+  if (!condition) {
+    std::fprintf(stderr, "FAILED: %s\n", description);
+    failure_count++;
+  }
+}
+
+void put_little_endian(char *data, std::uint64_t value, int byte_count) {
+  for (int index{0}; index < byte_count; index++) {
+    data[index] = static_cast<char>(value >> (8 * index));
+  }
+}
+
+std::uint64_t get_little_endian(const char *data, int byte_count) {
+  std::uint64_t value{0};
+  for (int index{0}; index < byte_count; index++) {
+    value |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[index]))
+             << (8 * index);
+  }
+  return value;
+}
+
+std::string request_frame(std::uint32_t id, std::uint8_t operation,
+                          const std::string &payload) {
+  char header[12]{};
+  put_little_endian(header, id, 4);
+  put_little_endian(header + 4, operation, 1);
+  put_little_endian(header + 8, payload.length(), 4);
+  return std::string(header, sizeof(header)) + payload;
+}
+
+int connect_to(const std::string &socket_path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, socket_path.c_str(),
+               sizeof(address.sun_path) - 1);
+  // The daemon creates its socket shortly after starting.
+  for (int attempt{0}; attempt < 200; attempt++) {
+    const int file_descriptor{::socket(AF_UNIX, SOCK_STREAM, 0)};
+    if (::connect(file_descriptor, reinterpret_cast<sockaddr *>(&address),
+                  sizeof(address)) == 0) {
+      return file_descriptor;
+    }
+    ::close(file_descriptor);
+    ::usleep(10000);
+  }
+  return -1;
+}
+
+// Reads until the daemon closes the connection.
+std::string read_all(int file_descriptor) {
+  std::string received;
+  char buffer[4096];
+  ssize_t read_length;
+  while ((read_length = ::read(file_descriptor, buffer, sizeof(buffer))) > 0) {
+    received.append(buffer, static_cast<std::size_t>(read_length));
+  }
+  return received;
+}
+
+// Requests sent just before the client shuts down its side are still
+// answered, and the daemon closes the connection once they are written.
+void test_half_close(const std::string &socket_path) {
+  const int file_descriptor{connect_to(socket_path)};
+  check(file_descriptor >= 0, "connect to daemon");
+  if (file_descriptor < 0) {
+    return;
+  }
+  const std::string request{request_frame(7, 0, "HELLOWORLD") +
+                            request_frame(8, 1, "ABCDEFGHI")};
+  check(::write(file_descriptor, request.data(), request.length()) ==
+            static_cast<ssize_t>(request.length()),
+        "write requests");
+  ::shutdown(file_descriptor, SHUT_WR);
+  const std::string response{read_all(file_descriptor)};
+  ::close(file_descriptor);
+
+  std::size_t offset{0};
+  int response_count{0};
+  bool is_encode_answered{false};
+  while (response.length() - offset >= 12) {
+    const std::uint64_t id{get_little_endian(response.data() + offset, 4)};
+    const std::uint64_t status{
+        get_little_endian(response.data() + offset + 4, 1)};
+    const std::uint64_t length{
+        get_little_endian(response.data() + offset + 8, 4)};
+    if (id == 7) {
+      is_encode_answered = status == 0 && length == 25;
+    }
+    offset += 12 + length;
+    response_count++;
+  }
+  check(offset == response.length(), "half-closed responses are whole frames");
+  check(response_count == 2, "half-closed connection gets both responses");
+  check(is_encode_answered, "half-closed encode is answered with a 5x5 grid");
+}
+
+// Reads one response frame, giving up after timeout_ms without data.
+std::string read_frame(int file_descriptor, int timeout_ms) {
+  std::string received;
+  char buffer[4096];
+  while (received.length() < 12 ||
+         received.length() < 12 + get_little_endian(received.data() + 8, 4)) {
+    pollfd readable{file_descriptor, POLLIN, 0};
+    if (::poll(&readable, 1, timeout_ms) != 1) {
+      break;
+    }
+    const ssize_t read_length{::read(file_descriptor, buffer, sizeof(buffer))};
+    if (read_length <= 0) {
+      break;
+    }
+    received.append(buffer, static_cast<std::size_t>(read_length));
+  }
+  return received;
+}
+
+// A lone request reaches a daemon whose workers have all gone to sleep and
+// is answered without waiting for another request to wake them.
+void test_idle_single_request(const std::string &socket_path) {
+  const int file_descriptor{connect_to(socket_path)};
+  check(file_descriptor >= 0, "connect to idle daemon");
+  if (file_descriptor < 0) {
+    return;
+  }
+  for (int round{0}; round < 20; round++) {
+    // Long enough for every worker to finish spinning and sleep.
+    ::usleep(20000);
+    const std::string request{request_frame(round, 0, "HELLOWORLD")};
+    if (::write(file_descriptor, request.data(), request.length()) !=
+        static_cast<ssize_t>(request.length())) {
+      check(false, "write request to idle daemon");
+      break;
+    }
+    const std::string response{read_frame(file_descriptor, 2000)};
+    if (response.length() != 12 + 25 ||
+        get_little_endian(response.data(), 4) !=
+            static_cast<std::uint64_t>(round)) {
+      check(false, "idle daemon answers a lone request");
+      break;
+    }
+  }
+  ::close(file_descriptor);
+}
+
+// A client that sends requests without reading the responses is paused:
+// the daemon stops reading, so the client's writes stall rather than the
+// daemon buffering without bound. Once the client reads, every request is
+// answered.
+void test_backpressure(const std::string &socket_path) {
+  const int file_descriptor{connect_to(socket_path)};
+  check(file_descriptor >= 0, "connect for backpressure");
+  if (file_descriptor < 0) {
+    return;
+  }
+  ::fcntl(file_descriptor, F_SETFL,
+          ::fcntl(file_descriptor, F_GETFL) | O_NONBLOCK);
+  constexpr std::size_t request_count{400000};
+  const std::string request{request_frame(1, 0, "HELLOWORLD")};
+  const std::size_t response_size{12 + 25};
+  std::string requests;
+  for (std::size_t index{0}; index < request_count; index++) {
+    requests += request;
+  }
+
+  // Write without reading until the daemon has stopped taking requests.
+  std::size_t sent{0};
+  while (sent < requests.length()) {
+    pollfd writable{file_descriptor, POLLOUT, 0};
+    if (::poll(&writable, 1, 500) != 1) {
+      break;
+    }
+    const ssize_t written{::write(file_descriptor, requests.data() + sent,
+                                  requests.length() - sent)};
+    if (written > 0) {
+      sent += static_cast<std::size_t>(written);
+    }
+  }
+  check(sent < requests.length(),
+        "daemon stops reading a client that does not read");
+
+  // Then read and write until every response has arrived.
+  std::size_t received{0};
+  char buffer[1 << 16];
+  while (received < request_count * response_size) {
+    pollfd ready{file_descriptor,
+                 static_cast<short>(POLLIN |
+                                    (sent < requests.length() ? POLLOUT : 0)),
+                 0};
+    if (::poll(&ready, 1, 5000) != 1) {
+      break;
+    }
+    if (ready.revents & POLLOUT) {
+      const ssize_t written{::write(file_descriptor, requests.data() + sent,
+                                    requests.length() - sent)};
+      if (written > 0) {
+        sent += static_cast<std::size_t>(written);
+      }
+    }
+    if (ready.revents & POLLIN) {
+      const ssize_t read_length{
+          ::read(file_descriptor, buffer, sizeof(buffer))};
+      if (read_length <= 0) {
+        break;
+      }
+      received += static_cast<std::size_t>(read_length);
+    }
+  }
+  check(received == request_count * response_size,
+        "paused client gets every response once it reads");
+  ::close(file_descriptor);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    std::fprintf(stderr, "Usage: daemon_test <encrypt_messages>\n");
+    return 2;
+  }
+  const std::string socket_path{"/tmp/daemon_test_" +
+                                std::to_string(::getpid()) + ".sock"};
+  const pid_t daemon{::fork()};
+  if (daemon == 0) {
+    ::execl(argv[1], argv[1], "serve", "--socket", socket_path.c_str(),
+            "--threads", "2", static_cast<char *>(nullptr));
+    std::_Exit(127);
+  }
+
+  test_half_close(socket_path);
+  test_idle_single_request(socket_path);
+  test_backpressure(socket_path);
+
+  ::kill(daemon, SIGTERM);
+  int daemon_status;
+  ::waitpid(daemon, &daemon_status, 0);
+  check(WIFEXITED(daemon_status) && WEXITSTATUS(daemon_status) == 0,
+        "daemon exits cleanly on SIGTERM");
+
+  if (failure_count == 0) {
+    std::printf("daemon_test: all tests passed\n");
+  }
+  return failure_count == 0 ? 0 : 1;
+}
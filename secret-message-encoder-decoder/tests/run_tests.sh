@@ -0,0 +1,13 @@
+#!/bin/sh
+# Builds the program and the tests, then runs every test.
+set -e
+cd "$(dirname "$0")"
+build=${BUILD_DIR:-/tmp/encrypt_messages_tests}
+mkdir -p "$build"
+c++ -std=c++17 -O2 -pthread ../src/encrypt_messages.cpp -o "$build/encrypt_messages"
+c++ -std=c++17 -O2 -pthread codec_test.cpp -o "$build/codec_test"
+c++ -std=c++17 -O2 -pthread archive_test.cpp -o "$build/archive_test"
+c++ -std=c++17 -O2 daemon_test.cpp -o "$build/daemon_test"
+"$build/codec_test"
+"$build/archive_test"
+"$build/daemon_test" "$build/encrypt_messages"